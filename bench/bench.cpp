@@ -0,0 +1,450 @@
+// Benchmarks for the tokenizer, the feature pipeline and the classifier.
+//
+// Build and run on Linux from the repository root:
+//   g++ -std=c++17 -O2 -pthread -Ibpe bench/bench.cpp $(ls bpe/*.cpp | grep -v main.cpp) -o bpe_bench
+//   cd bpe && ../bpe_bench --scales 1,10,100
+//   ../bpe_bench --check   (PairMap check only, exit code 1 on a mismatch)
+//
+// Scale 1 is SMSSpamCollection.txt itself, larger scales are synthetic corpora with that many
+// times the messages, built by recombining words of real messages of the same class. Every row
+// reports wall time, throughput, heap allocations made during the step and the process peak RSS.
+
+#include "bpe.h"
+#include "tokenizer.h"
+#include "decode_table.h"
+#include "data_handler.h"
+#include "feature_pipeline.h"
+#include "quantize.h"
+#include "nn.h"
+#include "pair_map.h"
+#include "similarity.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/resource.h>
+
+// global allocation counters, every operator new in the process goes through these, including
+// the over-aligned forms EmbeddingTable uses; the other new and delete forms forward here
+static std::atomic<size_t> alloc_count(0);
+static std::atomic<size_t> alloc_bytes(0);
+
+void* operator new(size_t size) {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+void* operator new(size_t size, std::align_val_t alignment) {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    // aligned_alloc wants a whole number of alignment units
+    const size_t align = static_cast<size_t>(alignment);
+    const size_t rounded = (std::max<size_t>(size, 1) + align - 1) / align * align;
+    if (void* p = std::aligned_alloc(align, rounded)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+// kept out of line: inlined into a caller, GCC pairs the free with that caller's operator new
+// and reports -Wmismatched-new-delete
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+void operator delete[](void* p) noexcept {
+    operator delete(p);
+}
+void operator delete(void* p, size_t) noexcept {
+    operator delete(p);
+}
+void operator delete[](void* p, size_t) noexcept {
+    operator delete(p);
+}
+void operator delete(void* p, std::align_val_t) noexcept {
+    operator delete(p);
+}
+void operator delete[](void* p, std::align_val_t) noexcept {
+    operator delete(p);
+}
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    operator delete(p);
+}
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+    operator delete(p);
+}
+
+namespace {
+
+const size_t INPUT_SIZE = 32;
+const size_t MAX_VOCAB_SIZE = 1000;
+const size_t TOP_N = 50;
+const size_t NN_EPOCHS = 20;
+const size_t KNN_QUERIES = 1000;
+const size_t KNN_K = 10;
+const size_t PAIR_COUNT_PASSES = 10;
+
+// std::hash<bpe::Pair> as it was before PairMap, the baseline for the pair_count rows
+struct LegacyPairHash {
+    size_t operator()(const bpe::Pair& p) const {
+        return std::hash<uint32_t>()(p.l) ^ (std::hash<uint32_t>()(p.r) << 1);
+    }
+};
+
+struct Message {
+    std::string label;
+    std::string text;
+};
+
+double peak_rss_mb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0; // kilobytes on Linux
+}
+
+// Times one step and prints a row. work is the amount processed, unit names it.
+class Bench {
+    std::string name;
+    size_t scale;
+    std::chrono::steady_clock::time_point start;
+    size_t allocs_before, bytes_before;
+
+public:
+    Bench(const std::string& name, size_t scale)
+        : name(name), scale(scale), start(std::chrono::steady_clock::now()),
+          allocs_before(alloc_count.load()), bytes_before(alloc_bytes.load()) {}
+
+    void done(double work, const char* unit) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        size_t allocs = alloc_count.load() - allocs_before;
+        double mb = (alloc_bytes.load() - bytes_before) / (1024.0 * 1024.0);
+        std::printf("%-22s %6zux %10.3f s %14.1f %-8s %12zu %10.1f MB %9.1f MB\n",
+            name.c_str(), scale, seconds, seconds > 0 ? work / seconds : 0.0, unit, allocs, mb, peak_rss_mb());
+        std::fflush(stdout);
+    }
+};
+
+std::vector<Message> load_messages(const std::string& path) {
+    std::vector<Message> messages;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t tab = line.find('\t');
+        if (line.empty() || tab == std::string::npos) continue;
+        messages.push_back({ line.substr(0, tab), line.substr(tab + 1) });
+    }
+    return messages;
+}
+
+// scale times the messages, each one built from words of random real messages of its class
+std::vector<Message> synthesize(const std::vector<Message>& real, size_t scale) {
+    if (scale <= 1) return real;
+    std::vector<std::string> ham_words, spam_words;
+    for (const auto& m : real) {
+        std::istringstream words(m.text);
+        std::string w;
+        while (words >> w) (m.label == "spam" ? spam_words : ham_words).push_back(w);
+    }
+    std::mt19937 gen(1234);
+    std::vector<Message> out;
+    out.reserve(real.size() * scale);
+    for (size_t s = 0; s < scale; ++s) {
+        for (const auto& m : real) {
+            const auto& pool = m.label == "spam" ? spam_words : ham_words;
+            std::uniform_int_distribution<size_t> pick(0, pool.size() - 1);
+            size_t words = 1 + std::count(m.text.begin(), m.text.end(), ' ');
+            std::string text;
+            for (size_t i = 0; i < words; ++i) {
+                if (i) text += ' ';
+                text += pool[pick(gen)];
+            }
+            out.push_back({ m.label, text });
+        }
+    }
+    return out;
+}
+
+std::string write_corpus(const std::vector<Message>& messages, size_t scale) {
+    std::string path = "bench_corpus_x" + std::to_string(scale) + ".txt";
+    std::ofstream out(path);
+    for (const auto& m : messages) out << m.label << '\t' << m.text << '\n';
+    return path;
+}
+
+void run_scale(const std::vector<Message>& real, size_t scale) {
+    std::vector<Message> messages = synthesize(real, scale);
+    std::vector<std::string> texts;
+    size_t text_bytes = 0;
+    for (const auto& m : messages) {
+        texts.push_back(m.text);
+        text_bytes += m.text.size();
+    }
+    const double mb = text_bytes / (1024.0 * 1024.0);
+
+    // single document run_bpe is unbounded in merges, only the real corpus is small enough
+    if (scale == 1) {
+        std::string joined;
+        for (const auto& t : texts) joined += t + '\n';
+        bpe::PairArray pairs;
+        bpe::Uint32Array tokens;
+        Bench b("run_bpe", scale);
+        bpe::run_bpe(joined, pairs, tokens);
+        b.done(mb, "MB/s");
+    }
+
+    bpe::Tokenizer tokenizer;
+    {
+        Bench b("learn_merges", scale);
+        tokenizer.train(texts, MAX_VOCAB_SIZE);
+        b.done(mb, "MB/s");
+    }
+
+    std::vector<bpe::Uint32Array> encoded(texts.size());
+    {
+        Bench b("encode", scale);
+        for (size_t i = 0; i < texts.size(); ++i) tokenizer.encode(texts[i], encoded[i]);
+        b.done(static_cast<double>(texts.size()), "msg/s");
+    }
+    {
+        // counting adjacent pairs of the encoded corpus, once per pass like a rescan merge step,
+        // with the table cleared and reused between passes
+        size_t pairs_seen = 0, checksum = 0;
+        {
+            std::unordered_map<bpe::Pair, size_t, LegacyPairHash> freq;
+            Bench b("pair_count_std_map", scale);
+            for (size_t pass = 0; pass < PAIR_COUNT_PASSES; ++pass) {
+                freq.clear();
+                for (const auto& tokens : encoded) {
+                    for (size_t i = 0; i + 1 < tokens.size(); ++i) freq[bpe::Pair{ tokens[i], tokens[i + 1] }]++;
+                    pairs_seen += tokens.size() > 0 ? tokens.size() - 1 : 0;
+                }
+            }
+            b.done(static_cast<double>(pairs_seen), "pair/s");
+            checksum = freq.size();
+        }
+        {
+            bpe::PairMap<size_t> freq;
+            Bench b("pair_count_flat", scale);
+            for (size_t pass = 0; pass < PAIR_COUNT_PASSES; ++pass) {
+                freq.clear();
+                for (const auto& tokens : encoded) {
+                    for (size_t i = 0; i + 1 < tokens.size(); ++i) freq[bpe::Pair{ tokens[i], tokens[i + 1] }]++;
+                }
+            }
+            b.done(static_cast<double>(pairs_seen), "pair/s");
+            if (freq.size() != checksum) std::printf("pair_count mismatch: %zu vs %zu\n", freq.size(), checksum);
+        }
+    }
+    {
+        std::string out;
+        Bench b("decode_table", scale);
+        for (const auto& tokens : encoded) tokenizer.decode(tokens, out);
+        b.done(mb, "MB/s");
+    }
+    {
+        Bench b("decode_tokens", scale);
+        for (const auto& tokens : encoded) bpe::decode_tokens(tokenizer.get_pairs(), tokens);
+        b.done(mb, "MB/s");
+    }
+
+    Data_Handler dh;
+    std::string path = write_corpus(messages, scale);
+    {
+        Bench b("read_csv", scale);
+        dh.read_csv(path, "\t", MAX_VOCAB_SIZE);
+        b.done(static_cast<double>(messages.size()), "msg/s");
+    }
+    std::remove(path.c_str());
+    std::streambuf* old = std::cout.rdbuf();
+    std::ostringstream sink;
+    std::cout.rdbuf(sink.rdbuf()); // split_data reports sizes
+    dh.split_data();
+    std::cout.rdbuf(old);
+
+    std::vector<uint32_t> selected;
+    {
+        // fit + select, split_data already fitted dh's selector so count again here
+        Bench b("chi_square", scale);
+        ChiSquareSelector selector;
+        selector.fit(dh.get_training_data());
+        selected = selector.select(TOP_N);
+        b.done(static_cast<double>(dh.get_training_data().size()), "msg/s");
+    }
+    std::printf("%-22s %6zux %10.1f MB token buffer, %zu tokens, %d-bit\n", "dataset", scale,
+        dh.get_dataset().memory_bytes() / (1024.0 * 1024.0), dh.get_dataset().get_token_count(),
+        static_cast<int>(dh.get_dataset().get_width()));
+
+    std::vector<std::vector<float>> features;
+    std::vector<float> labels;
+    {
+        Bench b("embed_and_average", scale);
+        const auto& training = dh.get_training_data();
+        const EmbeddingTable& table = dh.get_embeddings(INPUT_SIZE);
+        bpe::with_token_type(training.get_width(), [&](auto tag) {
+            using Token = decltype(tag);
+            for (size_t i = 0; i < training.size(); ++i) {
+                const BasicMessageView<Token> m = training.message<Token>(i);
+                features.emplace_back(INPUT_SIZE);
+                table.embed_and_average(m.tokens, m.count, features.back().data());
+                labels.push_back(static_cast<float>(m.label));
+            }
+        });
+        b.done(static_cast<double>(features.size()), "msg/s");
+    }
+    {
+        Bench b("feature_pipeline", scale);
+        FeaturePipeline pipeline(dh.get_embeddings(INPUT_SIZE), selected);
+        pipeline.transform(dh.get_training_data(), features, labels);
+        b.done(static_cast<double>(features.size()), "msg/s");
+    }
+
+    {
+        // top-k search of the first KNN_QUERIES messages against all of them
+        std::vector<float> matrix;
+        for (const auto& f : features) matrix.insert(matrix.end(), f.begin(), f.end());
+        const size_t queries = std::min(KNN_QUERIES, features.size());
+        std::vector<std::vector<Neighbor>> results;
+        VectorIndex flat(INPUT_SIZE);
+        flat.add(matrix.data(), features.size());
+        {
+            Bench b("knn_flat", scale);
+            flat.search_batch(matrix.data(), queries, KNN_K, results, 0);
+            b.done(static_cast<double>(queries), "query/s");
+        }
+        IvfIndex ivf;
+        {
+            Bench b("knn_ivf_build", scale);
+            ivf.build(matrix.data(), features.size(), INPUT_SIZE, 0);
+            b.done(static_cast<double>(features.size()), "vec/s");
+        }
+        {
+            Bench b("knn_ivf", scale);
+            ivf.search_batch(matrix.data(), queries, KNN_K, results, 0);
+            b.done(static_cast<double>(queries), "query/s");
+        }
+    }
+
+    NeuralNetwork nn(INPUT_SIZE, NN_EPOCHS);
+    {
+        Bench b("nn_train", scale);
+        nn.train(features, labels, 0.1f, 1.0f, 1.0f);
+        b.done(static_cast<double>(features.size() * NN_EPOCHS), "sample/s");
+    }
+    {
+        std::vector<float> matrix;
+        for (const auto& f : features) matrix.insert(matrix.end(), f.begin(), f.end());
+        NeuralNetwork mb(INPUT_SIZE, NN_EPOCHS);
+        TrainConfig config;
+        config.threads = 0;
+        Bench b("nn_train_minibatch", scale);
+        mb.train_minibatch(matrix, labels, config);
+        b.done(static_cast<double>(features.size() * NN_EPOCHS), "sample/s");
+    }
+    {
+        float sink_sum = 0.0f;
+        Bench b("nn_predict", scale);
+        for (const auto& f : features) sink_sum += nn.predict(f);
+        b.done(static_cast<double>(features.size()), "pred/s");
+        if (sink_sum < 0) std::printf("%f\n", sink_sum);
+    }
+    {
+        std::vector<float> matrix, out(features.size());
+        for (const auto& f : features) matrix.insert(matrix.end(), f.begin(), f.end());
+        {
+            Bench b("nn_predict_batch", scale);
+            nn.predict_batch(matrix.data(), features.size(), out.data(), 0);
+            b.done(static_cast<double>(features.size()), "pred/s");
+        }
+        QuantizedNetwork q_nn(nn, Precision::Int8);
+        {
+            Bench b("nn_predict_int8", scale);
+            q_nn.predict_batch(matrix.data(), features.size(), out.data(), 0);
+            b.done(static_cast<double>(features.size()), "pred/s");
+        }
+    }
+}
+
+// PairMap against std::unordered_map under random inserts, updates and erases. The keys all hash to
+// the last slots of a 16-slot table and at most 8 are live, so probe runs and backward-shift erases
+// keep wrapping from the end of the table to the start without the table growing.
+bool check_pair_map() {
+    std::vector<bpe::Pair> keys;
+    for (uint32_t l = 0; keys.size() < 24; ++l) {
+        const bpe::Pair p{ l, l * 7 + 1 };
+        if ((bpe::mix64(bpe::pack_pair(p)) & 15) >= 13) keys.push_back(p);
+    }
+    bpe::PairMap<uint32_t> map;
+    map.reserve(8);
+    std::unordered_map<uint64_t, uint32_t> expected;
+    std::mt19937 gen(42);
+    bool ok = true;
+    for (uint32_t step = 0; step < 200000 && ok; ++step) {
+        const bpe::Pair p = keys[gen() % keys.size()];
+        const uint64_t key = bpe::pack_pair(p);
+        if (gen() % 2 == 0 && (expected.count(key) || expected.size() < 8)) {
+            map[p] = step;
+            expected[key] = step;
+        }
+        else {
+            ok = map.erase(p) == (expected.erase(key) == 1);
+        }
+        ok = ok && map.size() == expected.size() && map.capacity() == 16;
+        for (const auto& k : keys) {
+            const uint32_t* value = map.find(k);
+            auto it = expected.find(bpe::pack_pair(k));
+            ok = ok && (value ? it != expected.end() && *value == it->second : it == expected.end());
+        }
+    }
+    std::printf("check %-12s %s\n", "pair_map", ok ? "ok" : "MISMATCH");
+    return ok;
+}
+
+std::vector<size_t> parse_scales(const std::string& arg) {
+    std::vector<size_t> scales;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) scales.push_back(std::stoul(item));
+    }
+    return scales;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    std::string corpus = "SMSSpamCollection.txt";
+    std::vector<size_t> scales = { 1, 10 };
+    bool check = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--scales" && i + 1 < argc) scales = parse_scales(argv[++i]);
+        else if (arg == "--corpus" && i + 1 < argc) corpus = argv[++i];
+        else if (arg == "--check") check = true;
+        else {
+            std::cerr << "usage: bpe_bench [--corpus SMSSpamCollection.txt] [--scales 1,10,100,1000] [--check]" << std::endl;
+            return 1;
+        }
+    }
+    if (check) return check_pair_map() ? 0 : 1;
+
+    std::vector<Message> real = load_messages(corpus);
+    if (real.empty()) {
+        std::cerr << "Error: No messages in " << corpus << std::endl;
+        return 1;
+    }
+    std::printf("%-22s %7s %12s %14s %-8s %12s %13s %12s\n", "benchmark", "scale", "time", "throughput", "", "allocs", "alloc bytes", "peak RSS");
+    for (size_t scale : scales) run_scale(real, scale);
+    return 0;
+}
@@ -0,0 +1,73 @@
+// Checks that the BPE trainers learn the same merges as the original rescan algorithm.
+//
+// Build and run on Linux from the repository root:
+//   g++ -std=c++17 -O2 -pthread -Ibpe bench/check_training.cpp bpe/bpe.cpp bpe/csv_reader.cpp bpe/mapped_file.cpp bpe/merge_state.cpp bpe/sharded_trainer.cpp bpe/trace.cpp -o check_training
+//   cd bpe && ../check_training
+//
+// The corpus is the text of every message in SMSSpamCollection.txt. Each trainer runs with a
+// vocabulary cap of 600 and with no cap; the exit code is 1 if any of them learns a PairArray
+// that differs from TrainMode::Rescan.
+
+#include "bpe.h"
+#include "sharded_trainer.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// the lines learn_merges_sharded trains on with delimiter "\t"
+std::vector<std::string> load_texts(const std::string& path) {
+    std::vector<std::string> texts;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t tab = line.find('\t');
+        if (line.empty() || tab == std::string::npos) continue;
+        texts.push_back(line.substr(tab + 1));
+    }
+    return texts;
+}
+
+bool same_pairs(const bpe::PairArray& a, const bpe::PairArray& b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    const std::string corpus = argc > 1 ? argv[1] : "SMSSpamCollection.txt";
+    std::vector<std::string> texts = load_texts(corpus);
+    if (texts.empty()) {
+        std::cerr << "Error: No messages in " << corpus << std::endl;
+        return 1;
+    }
+
+    bool ok = true;
+    for (size_t cap : { size_t(600), size_t(0) }) {
+        bpe::PairArray reference;
+        bpe::learn_merges(texts, reference, cap, bpe::TrainOptions(bpe::TrainMode::Rescan));
+        auto compare = [&](const char* name, const bpe::PairArray& pairs) {
+            const bool same = same_pairs(pairs, reference);
+            std::printf("check %-12s cap %4zu: %6zu pairs %s\n", name, cap, pairs.size(), same ? "ok" : "MISMATCH");
+            std::fflush(stdout);
+            ok = ok && same;
+        };
+
+        bpe::PairArray incremental, threaded, sharded;
+        bpe::learn_merges(texts, incremental, cap, bpe::TrainOptions(bpe::TrainMode::Incremental));
+        compare("incremental", incremental);
+        bpe::learn_merges(texts, threaded, cap, bpe::TrainOptions(bpe::TrainMode::Threaded, 4));
+        compare("threaded", threaded);
+        bpe::ShardOptions options;
+        options.workers = 3;
+        options.max_vocab_size = cap;
+        options.delimiter = "\t";
+        if (!bpe::learn_merges_sharded({ corpus }, sharded, options)) sharded.clear();
+        compare("sharded", sharded);
+    }
+    return ok ? 0 : 1;
+}
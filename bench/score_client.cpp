@@ -0,0 +1,133 @@
+// Load generator for the scoring server (bpe --model model.bin --socket PATH).
+// Opens --connections sockets, each sending one message at a time and waiting for the answer,
+// until --requests messages have been scored in total, then prints client-side latency
+// percentiles and throughput followed by the server's own "!stats" line.
+//
+//   g++ -std=c++17 -O2 -pthread bench/score_client.cpp -o score_client
+//   ./score_client --socket /tmp/bpe.sock --file bpe/SMSSpamCollection.txt --connections 8 --requests 50000
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int connect_to(const std::string& path) {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) return -1;
+    address.sun_family = AF_UNIX;
+    std::copy(path.begin(), path.end(), address.sun_path);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Reads one answer line; buffer keeps whatever arrived after it
+static bool read_line(int fd, std::string& buffer, std::string& line) {
+    for (;;) {
+        size_t newline = buffer.find('\n');
+        if (newline != std::string::npos) {
+            line.assign(buffer, 0, newline);
+            buffer.erase(0, newline + 1);
+            return true;
+        }
+        char chunk[4096];
+        ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buffer.append(chunk, static_cast<size_t>(n));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string socket_path = "/tmp/bpe.sock";
+    std::string file = "SMSSpamCollection.txt";
+    size_t connections = 4;
+    size_t requests = 20000;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) socket_path = argv[++i];
+        else if (arg == "--file" && i + 1 < argc) file = argv[++i];
+        else if (arg == "--connections" && i + 1 < argc) connections = std::stoul(argv[++i]);
+        else if (arg == "--requests" && i + 1 < argc) requests = std::stoul(argv[++i]);
+    }
+
+    // accept both label<TAB>message and plain one-message-per-line files
+    std::vector<std::string> messages;
+    std::ifstream in(file);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t tab = line.find('\t');
+        if (tab != std::string::npos) line = line.substr(tab + 1);
+        if (!line.empty()) messages.push_back(line);
+    }
+    if (messages.empty()) {
+        std::cerr << "Error: No messages in " << file << std::endl;
+        return 1;
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::vector<float>> latencies(connections);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t c = 0; c < connections; ++c) {
+        threads.emplace_back([&, c] {
+            int fd = connect_to(socket_path);
+            if (fd < 0) {
+                failed = true;
+                return;
+            }
+            std::string buffer, answer;
+            for (size_t i = next++; i < requests; i = next++) {
+                auto sent = std::chrono::steady_clock::now();
+                if (!send_all(fd, messages[i % messages.size()] + "\n") || !read_line(fd, buffer, answer)) {
+                    failed = true;
+                    break;
+                }
+                latencies[c].push_back(std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - sent).count());
+            }
+            ::close(fd);
+        });
+    }
+    for (auto& t : threads) t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (failed) {
+        std::cerr << "Error: Cannot talk to the server on " << socket_path << std::endl;
+        return 1;
+    }
+
+    std::vector<float> all;
+    for (auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+    auto percentile = [&](double p) { return all.empty() ? 0.0 : all[static_cast<size_t>(p * (all.size() - 1))]; };
+    std::printf("client: requests=%zu connections=%zu p50_us=%.1f p99_us=%.1f max_us=%.1f throughput=%.0f/s\n",
+        all.size(), connections, percentile(0.50), percentile(0.99), all.empty() ? 0.0 : all.back(), all.size() / seconds);
+
+    int fd = connect_to(socket_path);
+    std::string buffer, stats;
+    if (fd >= 0 && send_all(fd, "!stats\n") && read_line(fd, buffer, stats)) std::printf("server: %s\n", stats.c_str());
+    if (fd >= 0) ::close(fd);
+    return 0;
+}
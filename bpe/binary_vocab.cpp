@@ -0,0 +1,176 @@
+#include "binary_vocab.h"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+
+namespace bpe {
+
+uint64_t fnv1a_64(const void* data, size_t size, uint64_t hash) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+bool build_expansions(const PairArray& pairs, std::vector<uint64_t>& offsets, std::vector<char>& bytes) {
+    offsets.assign(pairs.size() + 1, 0);
+    // lengths first so the byte arena is allocated once
+    for (size_t i = 0; i < pairs.size(); ++i) {
+        const Pair& p = pairs[i];
+        uint64_t len = 1;
+        if (p.r != 0) {
+            if (p.l >= i || p.r >= i) return false;
+            len = (offsets[p.l + 1] - offsets[p.l]) + (offsets[p.r + 1] - offsets[p.r]);
+        }
+        offsets[i + 1] = offsets[i] + len;
+    }
+    bytes.resize(offsets[pairs.size()]);
+    for (size_t i = 0; i < pairs.size(); ++i) {
+        const Pair& p = pairs[i];
+        char* out = bytes.data() + offsets[i];
+        if (p.r == 0) {
+            *out = static_cast<char>(p.l);
+            continue;
+        }
+        size_t l_len = offsets[p.l + 1] - offsets[p.l];
+        size_t r_len = offsets[p.r + 1] - offsets[p.r];
+        std::memcpy(out, bytes.data() + offsets[p.l], l_len);
+        std::memcpy(out + l_len, bytes.data() + offsets[p.r], r_len);
+    }
+    return true;
+}
+
+bool serialize_binary_vocab(const PairArray& pairs, std::string& out) {
+    std::vector<uint64_t> offsets;
+    std::vector<char> bytes;
+    if (!build_expansions(pairs, offsets, bytes)) {
+        std::cerr << "\nError writing binary vocab: pair refers to an undefined token" << std::endl;
+        return false;
+    }
+
+    VocabHeader header{};
+    header.magic = VOCAB_MAGIC;
+    header.version = VOCAB_VERSION;
+    header.pair_count = static_cast<uint32_t>(pairs.size());
+    header.expansion_bytes = bytes.size();
+    uint64_t checksum = fnv1a_64(pairs.data(), pairs.size() * sizeof(Pair));
+    checksum = fnv1a_64(offsets.data(), offsets.size() * sizeof(uint64_t), checksum);
+    header.checksum = fnv1a_64(bytes.data(), bytes.size(), checksum);
+
+    out.clear();
+    out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.append(reinterpret_cast<const char*>(pairs.data()), pairs.size() * sizeof(Pair));
+    out.append(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+    out.append(bytes.data(), bytes.size());
+    return true;
+}
+
+bool write_binary_vocab(const std::string& filename, const PairArray& pairs) {
+    std::string buffer;
+    if (!serialize_binary_vocab(pairs, buffer)) return false;
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        std::cerr << "\nError writing binary vocab" << std::endl;
+        return false;
+    }
+    out.write(buffer.data(), buffer.size());
+    return static_cast<bool>(out);
+}
+
+PairArray read_binary_vocab(const std::string& filename) {
+    MappedVocab vocab;
+    if (!vocab.open(filename)) return PairArray();
+    return vocab.to_pair_array();
+}
+
+bool lookup_table_to_binary(const std::string& text_file, const std::string& binary_file) {
+    PairArray pairs = decompress_using_lookup_table(text_file);
+    if (pairs.empty()) {
+        std::cerr << "Error: Empty or missing lookup table: " << text_file << std::endl;
+        return false;
+    }
+    return write_binary_vocab(binary_file, pairs);
+}
+
+bool binary_to_lookup_table(const std::string& binary_file, const std::string& text_file) {
+    PairArray pairs = read_binary_vocab(binary_file);
+    if (pairs.empty()) return false;
+    write_lookup_table(text_file, pairs);
+    return true;
+}
+
+MappedVocab::MappedVocab() {}
+
+MappedVocab::~MappedVocab() {
+    close();
+}
+
+const VocabHeader* check_binary_vocab(const char* data, size_t size, bool verify_checksum) {
+    // validate header and section sizes before trusting any pointer into the buffer
+    if (size < sizeof(VocabHeader)) return nullptr;
+    const VocabHeader* h = reinterpret_cast<const VocabHeader*>(data);
+    if (h->magic != VOCAB_MAGIC || h->version != VOCAB_VERSION) return nullptr;
+    uint64_t expected = sizeof(VocabHeader) + uint64_t(h->pair_count) * sizeof(Pair)
+        + (uint64_t(h->pair_count) + 1) * sizeof(uint64_t) + h->expansion_bytes;
+    if (expected != size) return nullptr;
+    if (verify_checksum && fnv1a_64(data + sizeof(VocabHeader), size - sizeof(VocabHeader)) != h->checksum) return nullptr;
+    // decoding trusts the expansion ranges, so each must lie inside the bytes section
+    const uint64_t* offsets = reinterpret_cast<const uint64_t*>(data + sizeof(VocabHeader) + uint64_t(h->pair_count) * sizeof(Pair));
+    for (uint32_t i = 0; i < h->pair_count; ++i) {
+        if (offsets[i] > offsets[i + 1]) return nullptr;
+    }
+    if (offsets[h->pair_count] > h->expansion_bytes) return nullptr;
+    return h;
+}
+
+bool MappedVocab::open(const std::string& filename, bool verify_checksum) {
+    close();
+    if (!file.open(filename)) return false;
+    header = check_binary_vocab(file.data(), file.size(), verify_checksum);
+    if (!header) {
+        std::cerr << "Error: Corrupt or unsupported binary vocab: " << filename << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool MappedVocab::attach(const char* data, size_t size, bool verify_checksum) {
+    close();
+    header = check_binary_vocab(data, size, verify_checksum);
+    return header != nullptr;
+}
+
+void MappedVocab::close() {
+    file.close();
+    header = nullptr;
+}
+
+bool MappedVocab::is_open() const {
+    return header != nullptr;
+}
+
+size_t MappedVocab::size() const {
+    return header ? header->pair_count : 0;
+}
+
+const Pair* MappedVocab::pairs() const {
+    return reinterpret_cast<const Pair*>(reinterpret_cast<const char*>(header) + sizeof(VocabHeader));
+}
+
+const uint64_t* MappedVocab::offsets() const {
+    return reinterpret_cast<const uint64_t*>(pairs() + size());
+}
+
+const char* MappedVocab::bytes() const {
+    return reinterpret_cast<const char*>(offsets() + size() + 1);
+}
+
+PairArray MappedVocab::to_pair_array() const {
+    if (!header) return PairArray();
+    return PairArray(pairs(), pairs() + size());
+}
+
+}
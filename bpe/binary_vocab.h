@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include "bpe.h"
+#include "mapped_file.h"
+
+namespace bpe {
+
+// Binary vocabulary file, little endian, laid out so it can be used straight from an mmap:
+//   VocabHeader
+//   Pair     pairs[pair_count]
+//   uint64_t offsets[pair_count + 1]   token i expands to bytes[offsets[i] .. offsets[i + 1])
+//   char     bytes[expansion_bytes]
+// The checksum is FNV-1a 64 over everything after the header.
+const uint32_t VOCAB_MAGIC = 0x56455042; // "BPEV"
+const uint32_t VOCAB_VERSION = 1;
+
+struct VocabHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pair_count;
+    uint32_t reserved;
+    uint64_t expansion_bytes;
+    uint64_t checksum;
+};
+
+uint64_t fnv1a_64(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL);
+
+// Fills offsets (pairs.size() + 1 entries) and bytes with the byte expansion of every token.
+// Returns false if a pair refers to a token that is not defined before it.
+bool build_expansions(const PairArray& pairs, std::vector<uint64_t>& offsets, std::vector<char>& bytes);
+
+// Returns the header if data[0..size) is a complete binary vocab of this version whose expansion
+// offsets are non-decreasing and end inside the bytes section, else nullptr
+const VocabHeader* check_binary_vocab(const char* data, size_t size, bool verify_checksum = true);
+
+// Serializes pairs in the layout above into out, so it can be written or embedded in another file
+bool serialize_binary_vocab(const PairArray& pairs, std::string& out);
+bool write_binary_vocab(const std::string& filename, const PairArray& pairs);
+PairArray read_binary_vocab(const std::string& filename);
+
+// Converters between lookup_table.txt and the binary format, the text file stays the readable one
+bool lookup_table_to_binary(const std::string& text_file, const std::string& binary_file);
+bool binary_to_lookup_table(const std::string& binary_file, const std::string& text_file);
+
+/// <summary>
+/// Read only view of a binary vocabulary file mapped into memory, or of one embedded in a larger
+/// mapping such as a model file. Nothing is parsed or copied, pairs, offsets and bytes point
+/// straight into the mapping.
+/// </summary>
+class MappedVocab {
+    MappedFile file;
+    const VocabHeader* header = nullptr;
+
+public:
+    MappedVocab();
+    ~MappedVocab();
+    MappedVocab(const MappedVocab&) = delete;
+    MappedVocab& operator=(const MappedVocab&) = delete;
+
+    bool open(const std::string& filename, bool verify_checksum = true);
+    // views a vocab already in memory, data[0..size) must stay valid while the view is used
+    bool attach(const char* data, size_t size, bool verify_checksum = true);
+    void close();
+    bool is_open() const;
+
+    size_t size() const;
+    const Pair* pairs() const;
+    const uint64_t* offsets() const;
+    const char* bytes() const;
+    PairArray to_pair_array() const;
+};
+
+}
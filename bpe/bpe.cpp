@@ -1,7 +1,12 @@
 #include "bpe.h"
+#include "merge_state.h"
+#include "pair_map.h"
+#include "parallel.h"
+#include "trace.h"
 #include <iostream>
 #include <fstream>
 #include <cassert>
+#include <algorithm>
 
 namespace bpe {
 
@@ -10,6 +15,19 @@ bool Pair::operator==(const Pair& other) const {
     return l == other.l && r == other.r;
 }
 
+bool Pair::operator<(const Pair& other) const {
+    return l < other.l || (l == other.l && r < other.r);
+}
+
+TokenWidth token_width_for(size_t vocab_size) {
+    return vocab_size <= 65536 ? TokenWidth::Bits16 : TokenWidth::Bits32;
+}
+
+void print_merge(const MergeEvent& e) {
+    std::cout << "Tokens before merge: " << e.tokens_before << std::endl;
+    std::cout << "Merged most frequent pair: [" << e.pair.l << "," << e.pair.r << "] => token ID: " << e.token << std::endl;
+}
+
 void dump_tokens(const PairArray& pairs, const Uint32Array& tokens) {
     for (size_t i = 0; i < tokens.size(); i++) {
         uint32_t token = tokens[i];
@@ -30,44 +48,52 @@ void swap_tokens(Uint32Array& a, Uint32Array& b) {
     b.clear();
 }
 
-void run_bpe(const std::string& text, PairArray& pairs, Uint32Array& tokens_out) {
-    std::unordered_map<Pair, size_t> freq;
-    Uint32Array tokens_in;
-    Uint32Array temp_tokens;
+// picks the pair with the highest count, ties go to the smallest pair so the
+// result does not depend on hash map iteration order
+static bool is_better_pair(const Pair& a, size_t a_count, const Pair& b, size_t b_count) {
+    if (a_count != b_count) return a_count > b_count;
+    return a < b;
+}
 
-    // add base tokens for all 0-255 values
-    for (uint32_t i = 0; i < 256; ++i) {
-        pairs.push_back(Pair{ i, 0 });
-    }
+static bool vocab_full(const PairArray& pairs, size_t max_vocab_size) {
+    return max_vocab_size != 0 && pairs.size() >= max_vocab_size;
+}
 
-    // tokenise input text
-    for (char c : text) {
-        tokens_in.push_back(static_cast<uint8_t>(c));
-    }
+// Most frequent pair in a non-empty freq, ties go to the smaller pair
+static void most_frequent(const PairMap<size_t>& freq, Pair& best, size_t& best_count) {
+    best_count = 0;
+    freq.for_each([&](const Pair& p, size_t count) {
+        if (best_count == 0 || is_better_pair(p, count, best, best_count)) {
+            best = p;
+            best_count = count;
+        }
+    });
+}
+
+static void train_rescan(Uint32Array& tokens_in, PairArray& pairs, size_t max_vocab_size, const TrainOptions& options) {
+    PairMap<size_t> freq; // cleared, not freed, between merges
+    Uint32Array temp_tokens;
 
     // BPE merge loop
-    while (true) {
+    while (!vocab_full(pairs, max_vocab_size)) {
         freq.clear();
         for (size_t i = 0; i + 1 < tokens_in.size(); i++) {
+            if (tokens_in[i] == SEPARATOR || tokens_in[i + 1] == SEPARATOR) continue;
             Pair pair{ tokens_in[i], tokens_in[i + 1] };
             freq[pair]++;
         }
         if (freq.empty()) break;
-        auto max_it = freq.begin();
-        for (auto it = freq.begin(); it != freq.end(); ++it) {
-            if (it->second > max_it->second) {
-                max_it = it;
-            }
-        }
-        if (max_it->second <= 1) break;
-        std::cout << "Tokens before merge: " << tokens_in.size() << std::endl;
-        pairs.push_back(max_it->first);
-        std::cout << "Merged most frequent pair: [" << max_it->first.l << "," << max_it->first.r << "] => token ID: " << pairs.size() - 1 << std::endl;
+        Pair best;
+        size_t best_count;
+        most_frequent(freq, best, best_count);
+        if (best_count <= 1) break;
+        pairs.push_back(best);
+        if (options.on_merge) options.on_merge({ best, static_cast<uint32_t>(pairs.size() - 1), best_count, tokens_in.size() });
         temp_tokens.clear();
         for (size_t i = 0; i < tokens_in.size();) {
             if (i + 1 < tokens_in.size()) {
                 Pair pair{ tokens_in[i], tokens_in[i + 1] };
-                if (pair == max_it->first) {
+                if (pair == best) {
                     temp_tokens.push_back(static_cast<uint32_t>(pairs.size() - 1));
                     i += 2;
                     continue;
@@ -78,11 +104,159 @@ void run_bpe(const std::string& text, PairArray& pairs, Uint32Array& tokens_out)
         }
         swap_tokens(tokens_in, temp_tokens);
     }
+}
+
+// Incremental trainer, MergeState keeps the token stream and reports count
+// changes, MergeQueue keeps the live counts and picks the next merge.
+static void train_incremental(Uint32Array& tokens_in, PairArray& pairs, size_t max_vocab_size, const TrainOptions& options) {
+    MergeState state(std::move(tokens_in));
+    MergeQueue queue;
+    queue.add(state.initial_counts());
+
+    Pair merged;
+    size_t count;
+    while (!vocab_full(pairs, max_vocab_size) && queue.pop_best(merged, count)) {
+        pairs.push_back(merged);
+        const uint32_t new_token = static_cast<uint32_t>(pairs.size() - 1);
+        if (options.on_merge) options.on_merge({ merged, new_token, count, state.live_tokens() });
+        queue.add(state.merge(merged, new_token));
+    }
+    tokens_in = state.tokens();
+}
+
+// Threaded rescan. Every thread counts the pairs that start in its chunk into its
+// own table, the tables are summed, then every thread rewrites its chunk into a
+// local buffer. A merge starting on the last token of a chunk consumes the first
+// token of the next one: with c matches in a row ending just before a chunk,
+// left to right replacement merges every other one starting with the first, so
+// the chunk's first token is already taken when c is odd. This also covers runs
+// like "aaa" that cross chunk boundaries.
+static void train_threaded(Uint32Array& tokens_in, PairArray& pairs, size_t max_vocab_size, const TrainOptions& options) {
+    const size_t MIN_CHUNK = 4096; // smaller chunks cost more in thread start up than they save
+    const size_t thread_count = resolve_thread_count(options.threads);
+    std::vector<PairMap<size_t>> local_freq(thread_count);
+    std::vector<Uint32Array> local_tokens(thread_count);
+    std::vector<size_t> out_offset(thread_count + 1);
+    Uint32Array temp_tokens;
+
+    while (!vocab_full(pairs, max_vocab_size)) {
+        const size_t n = tokens_in.size();
+        const size_t chunks = std::max<size_t>(1, std::min(thread_count, n / MIN_CHUNK));
+        auto chunk_begin = [&](size_t c) { return n * c / chunks; };
+
+        parallel_chunks(chunks, [&](size_t c) {
+            auto& freq = local_freq[c];
+            freq.clear();
+            const size_t end = std::min(chunk_begin(c + 1), n > 0 ? n - 1 : 0);
+            for (size_t i = chunk_begin(c); i < end; ++i) {
+                if (tokens_in[i] == SEPARATOR || tokens_in[i + 1] == SEPARATOR) continue;
+                freq[Pair{ tokens_in[i], tokens_in[i + 1] }]++;
+            }
+        });
+        auto& freq = local_freq[0];
+        for (size_t c = 1; c < chunks; ++c) {
+            local_freq[c].for_each([&](const Pair& p, size_t count) { freq[p] += count; });
+        }
+        if (freq.empty()) break;
+        Pair merged;
+        size_t merged_count;
+        most_frequent(freq, merged, merged_count);
+        if (merged_count <= 1) break;
+
+        pairs.push_back(merged);
+        const uint32_t new_token = static_cast<uint32_t>(pairs.size() - 1);
+        if (options.on_merge) options.on_merge({ merged, new_token, merged_count, n });
+
+        parallel_chunks(chunks, [&](size_t c) {
+            auto matches = [&](size_t i) {
+                return i + 1 < n && tokens_in[i] == merged.l && tokens_in[i + 1] == merged.r;
+            };
+            const size_t begin = chunk_begin(c);
+            const size_t end = chunk_begin(c + 1);
+            size_t run = 0;
+            for (size_t j = begin; j > 0 && matches(j - 1); --j) run++;
+
+            Uint32Array& out = local_tokens[c];
+            out.clear();
+            for (size_t i = begin + (run % 2); i < end;) {
+                if (matches(i)) {
+                    out.push_back(new_token);
+                    i += 2;
+                    continue;
+                }
+                out.push_back(tokens_in[i]);
+                i += 1;
+            }
+        });
+
+        out_offset[0] = 0;
+        for (size_t c = 0; c < chunks; ++c) out_offset[c + 1] = out_offset[c] + local_tokens[c].size();
+        temp_tokens.resize(out_offset[chunks]);
+        parallel_chunks(chunks, [&](size_t c) {
+            std::copy(local_tokens[c].begin(), local_tokens[c].end(), temp_tokens.begin() + out_offset[c]);
+        });
+        swap_tokens(tokens_in, temp_tokens);
+    }
+}
+
+static void train(Uint32Array& tokens_in, PairArray& pairs, size_t max_vocab_size, const TrainOptions& options) {
+    trace::ScopedTimer timer("bpe.train", "bpe");
+    const size_t before = pairs.size();
+    if (options.mode == TrainMode::Incremental) {
+        train_incremental(tokens_in, pairs, max_vocab_size, options);
+    }
+    else if (options.mode == TrainMode::Threaded) {
+        train_threaded(tokens_in, pairs, max_vocab_size, options);
+    }
+    else {
+        train_rescan(tokens_in, pairs, max_vocab_size, options);
+    }
+    trace::counter("bpe.merges", static_cast<double>(pairs.size() - before));
+    trace::counter("bpe.tokens_out", static_cast<double>(tokens_in.size()));
+}
+static void add_base_tokens(PairArray& pairs) {
+    // add base tokens for all 0-255 values
+    for (uint32_t i = 0; i < 256; ++i) {
+        pairs.push_back(Pair{ i, 0 });
+    }
+}
+
+void run_bpe(const std::string& text, PairArray& pairs, Uint32Array& tokens_out, const TrainOptions& options) {
+    Uint32Array tokens_in;
+    add_base_tokens(pairs);
+
+    // tokenise input text
+    for (char c : text) {
+        tokens_in.push_back(static_cast<uint8_t>(c));
+    }
+
+    train(tokens_in, pairs, 0, options);
     tokens_out = tokens_in;
     // Write the lookup table to a file after BPE is done
     write_lookup_table("lookup_table.txt", pairs);
 }
 
+void learn_merges(const std::vector<std::string>& texts, PairArray& pairs, size_t max_vocab_size, const TrainOptions& options) {
+    learn_merges(std::vector<std::string_view>(texts.begin(), texts.end()), pairs, max_vocab_size, options);
+}
+
+void learn_merges(const std::vector<std::string_view>& texts, PairArray& pairs, size_t max_vocab_size, const TrainOptions& options) {
+    Uint32Array tokens_in;
+    add_base_tokens(pairs);
+
+    size_t total = 0;
+    for (const auto& text : texts) total += text.size() + 1;
+    tokens_in.reserve(total);
+    for (const auto& text : texts) {
+        for (char c : text) {
+            tokens_in.push_back(static_cast<uint8_t>(c));
+        }
+        tokens_in.push_back(SEPARATOR);
+    }
+
+    train(tokens_in, pairs, max_vocab_size, options);
+}
+
 void print_compressed_tokens(const Uint32Array& tokens) {
     for (size_t i = 0; i < tokens.size(); i++) {
         std::cout << tokens[i] << " ";
@@ -176,20 +350,38 @@ PairArray decompress_using_lookup_table(const std::string& filename) {
     return pairs;
 }
 
-std::string expand_token(const PairArray& pairs, uint32_t token) {
-    if (pairs[token].r == 0) {
-        return std::string(1, static_cast<char>(pairs[token].l));
-    }
-    else {
-        return expand_token(pairs, pairs[token].l) + expand_token(pairs, pairs[token].r);
+// appends the bytes of token to output, walking the pair tree with an explicit
+// stack instead of recursion so no temporary strings are created
+static void append_expansion(const PairArray& pairs, uint32_t token, std::string& output, Uint32Array& stack) {
+    stack.assign(1, token);
+    while (!stack.empty()) {
+        uint32_t t = stack.back();
+        stack.pop_back();
+        assert(t < pairs.size());
+        if (pairs[t].r == 0) {
+            output.push_back(static_cast<char>(pairs[t].l));
+        }
+        else {
+            stack.push_back(pairs[t].r);
+            stack.push_back(pairs[t].l);
+        }
     }
 }
 
+std::string expand_token(const PairArray& pairs, uint32_t token) {
+    std::string output;
+    Uint32Array stack;
+    append_expansion(pairs, token, output, stack);
+    return output;
+}
+
+// for decoding many streams with the same vocabulary use DecodeTable instead
 std::string decode_tokens(const PairArray& pairs, const Uint32Array& tokens) {
     std::string output;
+    Uint32Array stack;
     for (size_t i = 0; i < tokens.size(); i++)
     {
-        output += expand_token(pairs, tokens[i]);
+        append_expansion(pairs, tokens[i], output, stack);
     }
     return output;
 }
@@ -198,5 +390,5 @@ std::string decode_tokens(const PairArray& pairs, const Uint32Array& tokens) {
 
 // hash specialization
 size_t std::hash<bpe::Pair>::operator()(const bpe::Pair& p) const {
-    return std::hash<uint32_t>()(p.l) ^ (std::hash<uint32_t>()(p.r) << 1);
+    return static_cast<size_t>(bpe::mix64(bpe::pack_pair(p)));
 }
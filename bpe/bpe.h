@@ -3,22 +3,76 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <cstdint>
 #include <unordered_map>
+#include <functional>
 
 namespace bpe {
 
 struct Pair {
     uint32_t l, r;
     bool operator==(const Pair& other) const;
+    bool operator<(const Pair& other) const;
 };
 
 using PairArray = std::vector<Pair>;
 using Uint32Array = std::vector<uint32_t>;
+using Uint16Array = std::vector<uint16_t>;
 
+// Bits per stored token. Streams are kept 16 bits wide whenever every token ID of the
+// vocabulary fits, which halves their memory and bandwidth.
+enum class TokenWidth : uint8_t {
+    Bits16 = 16,
+    Bits32 = 32
+};
+
+TokenWidth token_width_for(size_t vocab_size);
+
+// Calls body(Token()) with Token = uint16_t or uint32_t matching width, so a pass over a
+// token stream is compiled once per width and chooses between them once per pass.
+template<class F>
+void with_token_type(TokenWidth width, F&& body) {
+    if (width == TokenWidth::Bits16) body(uint16_t());
+    else body(uint32_t());
+}
+
+// How run_bpe finds the next pair to merge. Both modes pick the most frequent
+// pair (ties go to the smallest pair) and so produce the same PairArray.
+enum class TrainMode {
+    Rescan,      // recount every adjacent pair after each merge
+    Incremental, // keep pair counts live and only update merge neighbours
+    Threaded     // Rescan with counting and replacement split across threads
+};
+
+struct MergeEvent {
+    Pair pair;
+    uint32_t token;       // ID given to the merged pair
+    size_t count;         // occurrences of the pair when it was picked
+    size_t tokens_before; // stream length before the merge, 0 where it is not tracked
+};
+
+// called once per learned merge, training is silent without one
+using MergeCallback = std::function<void(const MergeEvent&)>;
+
+struct TrainOptions {
+    TrainMode mode;
+    size_t threads; // TrainMode::Threaded only, 0 uses every hardware thread
+    MergeCallback on_merge;
+
+    TrainOptions(TrainMode mode = TrainMode::Incremental, size_t threads = 0) : mode(mode), threads(threads) {}
+};
+
+// MergeCallback that prints the classic per-merge progress lines to stdout
+void print_merge(const MergeEvent& e);
 void dump_tokens(const PairArray& pairs, const Uint32Array& tokens);
 void swap_tokens(Uint32Array& a, Uint32Array& b);
-void run_bpe(const std::string& text, PairArray& pairs, Uint32Array& tokens_out);
+void run_bpe(const std::string& text, PairArray& pairs, Uint32Array& tokens_out, const TrainOptions& options = TrainOptions());
+// Learns one set of merges over many documents. Pairs never span two documents,
+// training stops once pairs holds max_vocab_size entries (0 means no limit) and
+// nothing is written to disk.
+void learn_merges(const std::vector<std::string>& texts, PairArray& pairs, size_t max_vocab_size = 0, const TrainOptions& options = TrainOptions());
+void learn_merges(const std::vector<std::string_view>& texts, PairArray& pairs, size_t max_vocab_size = 0, const TrainOptions& options = TrainOptions());
 void print_compressed_tokens(const Uint32Array& tokens);
 void write_lookup_table(const std::string& filename, const PairArray& pairs);
 PairArray decompress_using_lookup_table(const std::string& filename);
@@ -0,0 +1,149 @@
+#include "chi_square.h"
+#include "parallel.h"
+#include "trace.h"
+#include <algorithm>
+
+// Counts the distinct tokens of each message into spam/ham document frequencies.
+// seen/stamp mark the tokens already counted for the current message.
+template<class Token>
+static void count_message(const Token* tokens, size_t count, uint8_t label,
+    std::vector<uint32_t>& spam_df, std::vector<uint32_t>& ham_df, std::vector<uint32_t>& seen, uint32_t& stamp) {
+    if (++stamp == 0) {
+        std::fill(seen.begin(), seen.end(), 0);
+        stamp = 1;
+    }
+    std::vector<uint32_t>& df = label == 1 ? spam_df : ham_df;
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t t = tokens[i];
+        if (t >= seen.size()) {
+            size_t size = std::max<size_t>(static_cast<size_t>(t) + 1, seen.size() * 2);
+            seen.resize(size, 0);
+            spam_df.resize(size, 0);
+            ham_df.resize(size, 0);
+        }
+        if (seen[t] == stamp) continue;
+        seen[t] = stamp;
+        df[t]++;
+    }
+}
+
+void ChiSquareSelector::fit(const DatasetView& data, size_t threads) {
+    trace::ScopedTimer timer("features.chi_square_fit", "features");
+    spam_df.clear();
+    ham_df.clear();
+    seen.clear();
+    stamp = 0;
+    spam_docs = ham_docs = 0;
+
+    // each chunk counts a contiguous slice into its own arrays, which are summed afterwards
+    size_t chunks = std::max<size_t>(1, std::min(bpe::resolve_thread_count(threads), data.size() / 256));
+    struct Partial {
+        std::vector<uint32_t> spam_df, ham_df, seen;
+        uint32_t stamp = 0;
+        size_t spam_docs = 0, ham_docs = 0;
+    };
+    std::vector<Partial> partials(chunks);
+    bpe::with_token_type(data.get_width(), [&](auto tag) {
+        using Token = decltype(tag);
+        bpe::parallel_chunks(chunks, [&](size_t c) {
+            Partial& p = partials[c];
+            size_t begin = data.size() * c / chunks;
+            size_t end = data.size() * (c + 1) / chunks;
+            for (size_t i = begin; i < end; ++i) {
+                const BasicMessageView<Token> m = data.message<Token>(i);
+                count_message(m.tokens, m.count, m.label, p.spam_df, p.ham_df, p.seen, p.stamp);
+                if (m.label == 1) p.spam_docs++;
+                else p.ham_docs++;
+            }
+        });
+    });
+
+    for (auto& p : partials) {
+        if (p.spam_df.size() > spam_df.size()) {
+            spam_df.resize(p.spam_df.size(), 0);
+            ham_df.resize(p.ham_df.size(), 0);
+        }
+        for (size_t t = 0; t < p.spam_df.size(); ++t) {
+            spam_df[t] += p.spam_df[t];
+            ham_df[t] += p.ham_df[t];
+        }
+        spam_docs += p.spam_docs;
+        ham_docs += p.ham_docs;
+    }
+    seen.assign(spam_df.size(), 0);
+}
+
+template<class Token>
+void ChiSquareSelector::add(const Token* tokens, size_t count, uint8_t label) {
+    count_message(tokens, count, label, spam_df, ham_df, seen, stamp);
+    if (label == 1) spam_docs++;
+    else ham_docs++;
+}
+
+void ChiSquareSelector::add(const std::vector<uint32_t>& tokens, uint8_t label) {
+    add(tokens.data(), tokens.size(), label);
+}
+
+void ChiSquareSelector::add(const Data& message) {
+    add(message.get_feature_vector(), message.get_label());
+}
+
+double ChiSquareSelector::score(uint32_t token) const {
+    // chi_sqr = sum (observed - expected)^2 / expected over the 2x2 table
+    // A/B: spam/ham messages with the token, C/D: spam/ham messages without it
+    double A = token < spam_df.size() ? spam_df[token] : 0;
+    double B = token < ham_df.size() ? ham_df[token] : 0;
+    double C = static_cast<double>(spam_docs) - A;
+    double D = static_cast<double>(ham_docs) - B;
+
+    double total = static_cast<double>(spam_docs + ham_docs);
+    if (total == 0) return 0.0;
+    double expected_A = (A + B) * spam_docs / total;
+    double expected_B = (A + B) * ham_docs / total;
+    double expected_C = (C + D) * spam_docs / total;
+    double expected_D = (C + D) * ham_docs / total;
+
+    double chi_sqr = 0.0;
+    if (expected_A > 0) chi_sqr += ((A - expected_A) * (A - expected_A)) / expected_A;
+    if (expected_B > 0) chi_sqr += ((B - expected_B) * (B - expected_B)) / expected_B;
+    if (expected_C > 0) chi_sqr += ((C - expected_C) * (C - expected_C)) / expected_C;
+    if (expected_D > 0) chi_sqr += ((D - expected_D) * (D - expected_D)) / expected_D;
+    return chi_sqr;
+}
+
+std::vector<uint32_t> ChiSquareSelector::select(size_t top_n) const {
+    struct FeatureScore {
+        uint32_t feature;
+        double chi_sqr;
+        bool operator<(const FeatureScore& other) const {
+            if (chi_sqr != other.chi_sqr) return chi_sqr > other.chi_sqr;
+            return feature < other.feature;
+        }
+    };
+
+    std::vector<FeatureScore> scores;
+    for (size_t t = 0; t < spam_df.size(); ++t) {
+        if (spam_df[t] == 0 && ham_df[t] == 0) continue;
+        scores.push_back({ static_cast<uint32_t>(t), score(static_cast<uint32_t>(t)) });
+    }
+
+    size_t n = std::min(top_n, scores.size());
+    if (n < scores.size()) std::nth_element(scores.begin(), scores.begin() + n, scores.end());
+    std::sort(scores.begin(), scores.begin() + n);
+
+    std::vector<uint32_t> top_features;
+    top_features.reserve(n);
+    for (size_t i = 0; i < n; ++i) top_features.push_back(scores[i].feature);
+    return top_features;
+}
+
+size_t ChiSquareSelector::get_spam_docs() const {
+    return spam_docs;
+}
+
+size_t ChiSquareSelector::get_ham_docs() const {
+    return ham_docs;
+}
+
+template void ChiSquareSelector::add<uint16_t>(const uint16_t*, size_t, uint8_t);
+template void ChiSquareSelector::add<uint32_t>(const uint32_t*, size_t, uint8_t);
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "data.h"
+#include "dataset.h"
+
+/// <summary>
+/// Chi-square feature selection over per-class document frequencies. Counts live in dense
+/// arrays indexed by token ID, so new labelled messages can be added one at a time without
+/// rescanning the messages already counted.
+/// </summary>
+class ChiSquareSelector {
+    std::vector<uint32_t> spam_df; // spam messages containing each token
+    std::vector<uint32_t> ham_df;  // ham messages containing each token
+    size_t spam_docs = 0;
+    size_t ham_docs = 0;
+    std::vector<uint32_t> seen;    // last message stamp per token, dedupes tokens in add()
+    uint32_t stamp = 0;
+
+public:
+    /// <summary>
+    /// Drops all counts and recounts data, splitting the messages across threads
+    /// (0 = one per hardware thread).
+    /// </summary>
+    void fit(const DatasetView& data, size_t threads = 0);
+
+    /// <summary>
+    /// Counts one more labelled message. Each distinct token counts once per message.
+    /// </summary>
+    template<class Token>
+    void add(const Token* tokens, size_t count, uint8_t label);
+    void add(const std::vector<uint32_t>& tokens, uint8_t label);
+    void add(const Data& message);
+
+    /// <summary>
+    /// Returns the top_n tokens by chi-square score, highest first. Ties go to the smaller token ID.
+    /// Only tokens seen in at least one counted message are candidates.
+    /// </summary>
+    std::vector<uint32_t> select(size_t top_n) const;
+
+    double score(uint32_t token) const;
+    size_t get_spam_docs() const;
+    size_t get_ham_docs() const;
+};
@@ -0,0 +1,336 @@
+#include "container.h"
+#include "binary_vocab.h"
+#include "decode_table.h"
+#include "tokenizer.h"
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+
+namespace bpe {
+
+uint32_t bits_for_vocab(size_t vocab_size) {
+    uint32_t bits = 1;
+    while (bits < 32 && (uint64_t(1) << bits) < vocab_size) bits++;
+    return bits;
+}
+
+uint64_t vocab_checksum(const PairArray& pairs) {
+    return fnv1a_64(pairs.data(), pairs.size() * sizeof(Pair));
+}
+
+void pack_tokens(const Uint32Array& tokens, uint32_t bits, std::vector<uint8_t>& out) {
+    out.clear();
+    out.reserve((tokens.size() * bits + 7) / 8);
+    uint64_t acc = 0;
+    uint32_t filled = 0;
+    for (uint32_t t : tokens) {
+        acc |= uint64_t(t) << filled;
+        filled += bits;
+        while (filled >= 8) {
+            out.push_back(static_cast<uint8_t>(acc));
+            acc >>= 8;
+            filled -= 8;
+        }
+    }
+    if (filled > 0) out.push_back(static_cast<uint8_t>(acc));
+}
+
+bool unpack_tokens(const uint8_t* data, size_t size, size_t count, uint32_t bits, Uint32Array& tokens) {
+    // compare without multiplying, a corrupt count can overflow count * bits
+    if (bits == 0 || bits > 32 || count > uint64_t(size) * 8 / bits) return false;
+    if ((uint64_t(count) * bits + 7) / 8 > size) return false;
+    tokens.resize(count);
+    const uint64_t mask = (uint64_t(1) << bits) - 1;
+    uint64_t acc = 0;
+    uint32_t filled = 0;
+    size_t pos = 0;
+    for (size_t i = 0; i < count; ++i) {
+        while (filled < bits) {
+            acc |= uint64_t(data[pos++]) << filled;
+            filled += 8;
+        }
+        tokens[i] = static_cast<uint32_t>(acc & mask);
+        acc >>= bits;
+        filled -= bits;
+    }
+    return true;
+}
+
+void varint_encode_tokens(const Uint32Array& tokens, std::vector<uint8_t>& out) {
+    out.clear();
+    out.reserve(tokens.size() * 2);
+    for (uint32_t t : tokens) {
+        while (t >= 0x80) {
+            out.push_back(static_cast<uint8_t>(t | 0x80));
+            t >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(t));
+    }
+}
+
+bool varint_decode_tokens(const uint8_t* data, size_t size, size_t count, Uint32Array& tokens) {
+    if (count > size) return false; // every token takes at least one byte
+    tokens.resize(count);
+    size_t pos = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t value = 0;
+        for (uint32_t shift = 0;; shift += 7) {
+            if (pos >= size || shift > 28) return false;
+            uint8_t byte = data[pos++];
+            value |= uint32_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) break;
+        }
+        tokens[i] = value;
+    }
+    return pos == size;
+}
+
+static void encode_values(const ContainerHeader& header, const Uint32Array& values, std::vector<uint8_t>& out) {
+    if (header.coding == static_cast<uint32_t>(TokenCoding::Varint)) {
+        varint_encode_tokens(values, out);
+    }
+    else {
+        pack_tokens(values, header.bits_per_token, out);
+    }
+}
+
+static bool decode_values(const ContainerHeader& header, const std::vector<uint8_t>& data, size_t count, Uint32Array& values) {
+    return header.coding == static_cast<uint32_t>(TokenCoding::Varint)
+        ? varint_decode_tokens(data.data(), data.size(), count, values)
+        : unpack_tokens(data.data(), data.size(), count, header.bits_per_token, values);
+}
+
+const uint32_t BYTE_TOKENS = 256; // pairs[i] == { i, 0 } for every byte value, never stored
+
+static bool read_block(std::istream& in, size_t block_size, std::string& block) {
+    block.resize(block_size);
+    in.read(&block[0], static_cast<std::streamsize>(block_size));
+    block.resize(static_cast<size_t>(in.gcount()));
+    return !block.empty();
+}
+
+static void write_frame(std::ostream& out, const Tokenizer& vocab, const ContainerHeader& header, const std::string& block, Uint32Array& tokens, std::vector<uint8_t>& payload) {
+    vocab.encode(block, tokens);
+    encode_values(header, tokens, payload);
+    FrameHeader frame{ block.size(), tokens.size(), payload.size(), fnv1a_64(block.data(), block.size()) };
+    out.write(reinterpret_cast<const char*>(&frame), sizeof(frame));
+    out.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+}
+
+static bool compress_blocks(std::istream& in, std::ostream& out, const Tokenizer& vocab, const CompressOptions& options, const std::string* first_block) {
+    const PairArray& pairs = vocab.get_pairs();
+    bool byte_tokens = pairs.size() >= BYTE_TOKENS;
+    for (uint32_t i = 0; byte_tokens && i < BYTE_TOKENS; ++i) {
+        byte_tokens = pairs[i] == Pair{ i, 0 };
+    }
+    if (options.embed_vocab && !byte_tokens) {
+        std::cerr << "Error: Vocabulary does not start with the 256 byte tokens" << std::endl;
+        return false;
+    }
+    ContainerHeader header{};
+    header.magic = CONTAINER_MAGIC;
+    header.version = CONTAINER_VERSION;
+    header.coding = static_cast<uint32_t>(options.coding);
+    header.flags = options.embed_vocab ? CONTAINER_EMBEDDED_VOCAB : 0;
+    header.pair_count = static_cast<uint32_t>(pairs.size());
+    header.bits_per_token = bits_for_vocab(pairs.size());
+    header.vocab_checksum = vocab_checksum(pairs);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    Uint32Array tokens;
+    std::vector<uint8_t> payload;
+    if (options.embed_vocab) {
+        // merge pairs only, flattened to l, r, l, r, ... and coded like the token stream
+        tokens.clear();
+        for (size_t i = BYTE_TOKENS; i < pairs.size(); ++i) {
+            tokens.push_back(pairs[i].l);
+            tokens.push_back(pairs[i].r);
+        }
+        encode_values(header, tokens, payload);
+        const uint64_t vocab_bytes = payload.size();
+        out.write(reinterpret_cast<const char*>(&vocab_bytes), sizeof(vocab_bytes));
+        out.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+    }
+    if (first_block && !first_block->empty()) {
+        write_frame(out, vocab, header, *first_block, tokens, payload);
+    }
+    std::string block;
+    while (read_block(in, options.block_size, block)) {
+        write_frame(out, vocab, header, block, tokens, payload);
+    }
+    FrameHeader end{};
+    out.write(reinterpret_cast<const char*>(&end), sizeof(end));
+    return static_cast<bool>(out);
+}
+
+bool compress(std::istream& in, std::ostream& out, const CompressOptions& options) {
+    std::string first;
+    read_block(in, options.block_size, first);
+    Tokenizer vocab;
+    vocab.train(std::vector<std::string_view>{ first }, options.max_vocab_size);
+    return compress_blocks(in, out, vocab, options, &first);
+}
+
+bool compress(std::istream& in, std::ostream& out, const Tokenizer& vocab, const CompressOptions& options) {
+    return compress_blocks(in, out, vocab, options, nullptr);
+}
+
+const uint32_t MAX_PAIRS = 1u << 24;       // larger vocabularies are corrupt headers
+const uint64_t MAX_FRAME_BYTES = 1ull << 30; // payload limit when the stream size is unknown
+
+// Bytes left in a seekable stream, or UINT64_MAX when the stream cannot tell
+static uint64_t bytes_left(std::istream& in) {
+    const std::streampos here = in.tellg();
+    if (here < 0) {
+        in.clear();
+        return UINT64_MAX;
+    }
+    in.seekg(0, std::ios::end);
+    const std::streampos end = in.tellg();
+    in.clear();
+    in.seekg(here);
+    return end < here ? UINT64_MAX : static_cast<uint64_t>(end - here);
+}
+
+// old layout: uint32 pair count, pairs, uint32 token count, uint32 tokens
+static bool decompress_legacy(std::istream& in, std::ostream& out, uint32_t pair_count) {
+    uint64_t remaining = bytes_left(in);
+    if (pair_count < 256 || pair_count > MAX_PAIRS || uint64_t(pair_count) * sizeof(Pair) > remaining) {
+        std::cerr << "Error: Not a compressed container" << std::endl;
+        return false;
+    }
+    PairArray pairs(pair_count);
+    uint32_t token_count = 0;
+    in.read(reinterpret_cast<char*>(pairs.data()), static_cast<std::streamsize>(pairs.size() * sizeof(Pair)));
+    in.read(reinterpret_cast<char*>(&token_count), sizeof(token_count));
+    remaining -= remaining == UINT64_MAX ? 0 : pairs.size() * sizeof(Pair) + sizeof(token_count);
+    if (!in || uint64_t(token_count) * sizeof(uint32_t) > std::min(remaining, MAX_FRAME_BYTES)) {
+        std::cerr << "Error: Truncated or corrupt compressed container" << std::endl;
+        return false;
+    }
+    Uint32Array tokens(token_count);
+    in.read(reinterpret_cast<char*>(tokens.data()), static_cast<std::streamsize>(tokens.size() * sizeof(uint32_t)));
+    DecodeTable decoder(pairs);
+    if (!in || decoder.size() != pairs.size()) return false;
+    for (uint32_t t : tokens) {
+        if (t >= decoder.size()) return false;
+    }
+    std::string text;
+    decoder.decode(tokens, text);
+    out.write(text.data(), static_cast<std::streamsize>(text.size()));
+    return static_cast<bool>(out);
+}
+
+bool decompress(std::istream& in, std::ostream& out, const Tokenizer* vocab) {
+    ContainerHeader header{};
+    in.read(reinterpret_cast<char*>(&header), sizeof(uint32_t));
+    if (!in) return false;
+    if (header.magic != CONTAINER_MAGIC) {
+        return decompress_legacy(in, out, header.magic);
+    }
+    in.read(reinterpret_cast<char*>(&header) + sizeof(uint32_t), sizeof(header) - sizeof(uint32_t));
+    if (!in || header.version < 1 || header.version > CONTAINER_VERSION || header.coding > static_cast<uint32_t>(TokenCoding::Varint)) {
+        std::cerr << "Error: Unsupported compressed container" << std::endl;
+        return false;
+    }
+
+    // every size read from the file is checked against what is left before anything is allocated
+    uint64_t remaining = bytes_left(in);
+    const bool varint = header.coding == static_cast<uint32_t>(TokenCoding::Varint);
+    if (!varint && (header.bits_per_token == 0 || header.bits_per_token > 32)) {
+        std::cerr << "Error: Truncated or corrupt compressed container" << std::endl;
+        return false;
+    }
+    PairArray pairs;
+    std::vector<uint8_t> payload;
+    Uint32Array tokens;
+    if ((header.flags & CONTAINER_EMBEDDED_VOCAB) && header.version == 1) {
+        // version 1 stored every pair raw, byte tokens included
+        if (header.pair_count > MAX_PAIRS || uint64_t(header.pair_count) * sizeof(Pair) > remaining) {
+            std::cerr << "Error: Truncated or corrupt compressed container" << std::endl;
+            return false;
+        }
+        pairs.resize(header.pair_count);
+        in.read(reinterpret_cast<char*>(pairs.data()), static_cast<std::streamsize>(pairs.size() * sizeof(Pair)));
+        if (remaining != UINT64_MAX) remaining -= pairs.size() * sizeof(Pair);
+    }
+    else if (header.flags & CONTAINER_EMBEDDED_VOCAB) {
+        uint64_t vocab_bytes = 0;
+        in.read(reinterpret_cast<char*>(&vocab_bytes), sizeof(vocab_bytes));
+        if (remaining != UINT64_MAX) remaining -= std::min<uint64_t>(remaining, sizeof(vocab_bytes));
+        if (!in || header.pair_count < BYTE_TOKENS || header.pair_count > MAX_PAIRS || vocab_bytes > std::min(remaining, MAX_FRAME_BYTES)) {
+            std::cerr << "Error: Truncated or corrupt compressed container" << std::endl;
+            return false;
+        }
+        if (remaining != UINT64_MAX) remaining -= vocab_bytes;
+        payload.resize(vocab_bytes);
+        in.read(reinterpret_cast<char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+        if (!in || !decode_values(header, payload, 2 * size_t(header.pair_count - BYTE_TOKENS), tokens)) {
+            std::cerr << "Error: Truncated or corrupt compressed container" << std::endl;
+            return false;
+        }
+        pairs.reserve(header.pair_count);
+        for (uint32_t i = 0; i < BYTE_TOKENS; ++i) {
+            pairs.push_back(Pair{ i, 0 });
+        }
+        for (size_t i = 0; i < tokens.size(); i += 2) {
+            pairs.push_back(Pair{ tokens[i], tokens[i + 1] });
+        }
+    }
+    else if (vocab) {
+        pairs = vocab->get_pairs();
+    }
+    if (!in || pairs.size() != header.pair_count || vocab_checksum(pairs) != header.vocab_checksum) {
+        std::cerr << "Error: Missing or mismatched vocabulary for compressed container" << std::endl;
+        return false;
+    }
+    DecodeTable decoder(pairs);
+    if (decoder.size() != pairs.size()) return false;
+
+    FrameHeader frame{};
+    std::string text;
+    while (in.read(reinterpret_cast<char*>(&frame), sizeof(frame))) {
+        if (frame.raw_size == 0 && frame.token_count == 0 && frame.payload_size == 0) {
+            return static_cast<bool>(out);
+        }
+        if (remaining != UINT64_MAX) remaining -= sizeof(frame);
+        if (frame.payload_size > std::min(remaining, MAX_FRAME_BYTES)) break;
+        const uint64_t max_tokens = varint ? frame.payload_size : frame.payload_size * 8 / header.bits_per_token;
+        if (frame.token_count > max_tokens) break;
+        if (remaining != UINT64_MAX) remaining -= frame.payload_size;
+        payload.resize(frame.payload_size);
+        in.read(reinterpret_cast<char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+        if (!in) break;
+        if (!decode_values(header, payload, frame.token_count, tokens)) break;
+        for (uint32_t t : tokens) {
+            if (t >= decoder.size()) return false;
+        }
+        decoder.decode(tokens, text);
+        if (text.size() != frame.raw_size || fnv1a_64(text.data(), text.size()) != frame.checksum) break;
+        out.write(text.data(), static_cast<std::streamsize>(text.size()));
+    }
+    std::cerr << "Error: Truncated or corrupt compressed container" << std::endl;
+    return false;
+}
+
+bool compress_file(const std::string& input, const std::string& output, const CompressOptions& options) {
+    std::ifstream in(input, std::ios::binary);
+    std::ofstream out(output, std::ios::binary);
+    if (!in || !out) {
+        std::cerr << "\nError opening files for compression" << std::endl;
+        return false;
+    }
+    return compress(in, out, options);
+}
+
+bool decompress_file(const std::string& input, const std::string& output, const Tokenizer* vocab) {
+    std::ifstream in(input, std::ios::binary);
+    std::ofstream out(output, std::ios::binary);
+    if (!in || !out) {
+        std::cerr << "\nError opening files for decompression" << std::endl;
+        return false;
+    }
+    return decompress(in, out, vocab);
+}
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include "bpe.h"
+
+namespace bpe {
+
+class Tokenizer;
+
+// Compressed container, little endian:
+//   ContainerHeader
+//   uint64_t vocab_size, vocab[vocab_size]  only with CONTAINER_EMBEDDED_VOCAB
+//   { FrameHeader, payload[payload_size] }  one frame per block of input
+//   FrameHeader of zeros                    end marker, so truncation is detected
+// The embedded vocabulary holds the merge pairs after the 256 byte tokens, which the reader
+// rebuilds, as l, r, l, r, ... coded like the token stream. Version 1 stored all pair_count
+// pairs raw instead and is still read. Without an embedded vocabulary vocab_checksum names the
+// vocabulary the reader must supply.
+const uint32_t CONTAINER_MAGIC = 0x43455042; // "BPEC"
+const uint32_t CONTAINER_VERSION = 2;
+const uint32_t CONTAINER_EMBEDDED_VOCAB = 1;
+
+enum class TokenCoding : uint32_t {
+    BitPacked = 0, // every token in ceil(log2(vocab size)) bits
+    Varint = 1     // LEB128, small token IDs take one byte
+};
+
+struct ContainerHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t coding;
+    uint32_t flags;
+    uint32_t pair_count;
+    uint32_t bits_per_token;
+    uint64_t vocab_checksum;
+};
+
+struct FrameHeader {
+    uint64_t raw_size;     // decoded bytes
+    uint64_t token_count;
+    uint64_t payload_size; // encoded bytes that follow
+    uint64_t checksum;     // FNV-1a of the decoded bytes
+};
+
+struct CompressOptions {
+    TokenCoding coding = TokenCoding::BitPacked;
+    size_t block_size = 1 << 20;  // input bytes per frame
+    size_t max_vocab_size = 4096; // when the vocabulary is learned from the first block
+    bool embed_vocab = true;
+};
+
+uint32_t bits_for_vocab(size_t vocab_size);
+uint64_t vocab_checksum(const PairArray& pairs);
+
+void pack_tokens(const Uint32Array& tokens, uint32_t bits, std::vector<uint8_t>& out);
+bool unpack_tokens(const uint8_t* data, size_t size, size_t count, uint32_t bits, Uint32Array& tokens);
+void varint_encode_tokens(const Uint32Array& tokens, std::vector<uint8_t>& out);
+bool varint_decode_tokens(const uint8_t* data, size_t size, size_t count, Uint32Array& tokens);
+
+/// <summary>
+/// Streams in through BPE into a container. The first overload learns the vocabulary from the
+/// first block, the second uses an existing one.
+/// </summary>
+bool compress(std::istream& in, std::ostream& out, const CompressOptions& options = CompressOptions());
+bool compress(std::istream& in, std::ostream& out, const Tokenizer& vocab, const CompressOptions& options = CompressOptions());
+
+/// <summary>
+/// Decodes a container frame by frame. vocab is only needed when the container does not embed
+/// its vocabulary. Files in the old layout (pair count, pairs, token count, raw 32 bit tokens)
+/// are still read.
+/// </summary>
+bool decompress(std::istream& in, std::ostream& out, const Tokenizer* vocab = nullptr);
+
+bool compress_file(const std::string& input, const std::string& output, const CompressOptions& options = CompressOptions());
+bool decompress_file(const std::string& input, const std::string& output, const Tokenizer* vocab = nullptr);
+
+}
@@ -0,0 +1,74 @@
+#include "corpus_index.h"
+#include <algorithm>
+
+void CorpusIndex::clear() {
+    postings.clear();
+    message_count = token_count = vocab_size = 0;
+    max_token = 0;
+}
+
+void CorpusIndex::build(const Dataset& data) {
+    clear();
+    bpe::with_token_type(data.get_width(), [&](auto tag) {
+        using Token = decltype(tag);
+        for (size_t i = 0; i < data.size(); ++i) {
+            const BasicMessageView<Token> m = data.message<Token>(i);
+            add(m.tokens, m.count);
+        }
+    });
+}
+
+template<class Token>
+uint32_t CorpusIndex::add(const Token* tokens, size_t count) {
+    const uint32_t id = static_cast<uint32_t>(message_count++);
+    token_count += count;
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t t = tokens[i];
+        if (t >= postings.size()) postings.resize(std::max(static_cast<size_t>(t) + 1, postings.size() * 2));
+        std::vector<uint32_t>& list = postings[t];
+        // IDs only grow, so a repeat within this message is always the last entry
+        if (!list.empty() && list.back() == id) continue;
+        if (list.empty()) {
+            vocab_size++;
+            if (t > max_token) max_token = t;
+        }
+        list.push_back(id);
+    }
+    return id;
+}
+
+template uint32_t CorpusIndex::add<uint16_t>(const uint16_t*, size_t);
+template uint32_t CorpusIndex::add<uint32_t>(const uint32_t*, size_t);
+
+uint32_t CorpusIndex::add(const std::vector<uint32_t>& tokens) {
+    return add(tokens.data(), tokens.size());
+}
+
+const std::vector<uint32_t>& CorpusIndex::messages_with(uint32_t token) const {
+    static const std::vector<uint32_t> none;
+    return token < postings.size() ? postings[token] : none;
+}
+
+size_t CorpusIndex::document_frequency(uint32_t token) const {
+    return messages_with(token).size();
+}
+
+bool CorpusIndex::contains(uint32_t token) const {
+    return document_frequency(token) > 0;
+}
+
+size_t CorpusIndex::get_message_count() const {
+    return message_count;
+}
+
+size_t CorpusIndex::get_token_count() const {
+    return token_count;
+}
+
+size_t CorpusIndex::get_vocab_size() const {
+    return vocab_size;
+}
+
+uint32_t CorpusIndex::get_max_token() const {
+    return max_token;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "dataset.h"
+
+/// <summary>
+/// Inverted index from token ID to the IDs of the messages containing it. Message IDs are the order
+/// messages were added. Document frequencies, vocabulary size and the largest token are kept up to
+/// date as messages are added, so reading them never rescans the corpus.
+/// </summary>
+class CorpusIndex {
+    std::vector<std::vector<uint32_t>> postings; // postings[token] = ascending message IDs
+    size_t message_count = 0;
+    size_t token_count = 0;  // total tokens over all messages
+    size_t vocab_size = 0;   // tokens with at least one posting
+    uint32_t max_token = 0;
+
+public:
+    void clear();
+
+    /// <summary>
+    /// Indexes every message in data, in order.
+    /// </summary>
+    void build(const Dataset& data);
+
+    /// <summary>
+    /// Indexes one more message and returns its message ID. Repeated tokens are posted once.
+    /// </summary>
+    template<class Token>
+    uint32_t add(const Token* tokens, size_t count);
+    uint32_t add(const std::vector<uint32_t>& tokens);
+
+    /// <summary>
+    /// Message IDs containing token, ascending. Empty for tokens never seen.
+    /// </summary>
+    const std::vector<uint32_t>& messages_with(uint32_t token) const;
+    size_t document_frequency(uint32_t token) const;
+    bool contains(uint32_t token) const;
+
+    size_t get_message_count() const;
+    size_t get_token_count() const;
+    size_t get_vocab_size() const;
+    uint32_t get_max_token() const;
+};
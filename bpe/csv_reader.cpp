@@ -0,0 +1,94 @@
+#include "csv_reader.h"
+#include "parallel.h"
+#include <cstring>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace bpe {
+
+namespace {
+
+const size_t MIN_RANGE_BYTES = 1 << 20; // smaller ranges are not worth a thread
+
+inline unsigned lowest_bit(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+// Parses the lines starting in [begin, end) of data
+void parse_range(const char* begin, const char* end, std::string_view delimiter, std::vector<CsvRecord>& records) {
+    const char* line = begin;
+    while (line < end) {
+        const char* newline = find_newline(line, end);
+        std::string_view text(line, static_cast<size_t>(newline - line));
+        line = newline + 1;
+        if (!text.empty() && text.back() == '\r') text.remove_suffix(1);
+        if (text.empty()) continue;
+
+        size_t split = text.find(delimiter);
+        if (split == std::string_view::npos) continue;
+        records.push_back({ text.substr(0, split), text.substr(split + delimiter.size()) });
+    }
+}
+
+}
+
+const char* find_newline(const char* begin, const char* end) {
+    const char* p = begin;
+#if defined(__AVX2__)
+    const __m256i nl = _mm256_set1_epi8('\n');
+    for (; p + 32 <= end; p += 32) {
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), nl)));
+        if (mask) return p + lowest_bit(mask);
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; p + 16 <= end; p += 16) {
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), nl)));
+        if (mask) return p + lowest_bit(mask);
+    }
+#endif
+    const void* found = std::memchr(p, '\n', static_cast<size_t>(end - p));
+    return found ? static_cast<const char*>(found) : end;
+}
+
+void parse_records(const char* data, size_t size, std::string_view delimiter, std::vector<CsvRecord>& records, size_t threads) {
+    const char* end = data + size;
+    size_t ranges = std::max<size_t>(1, std::min(resolve_thread_count(threads), size / MIN_RANGE_BYTES));
+    if (ranges == 1) {
+        parse_range(data, end, delimiter, records);
+        return;
+    }
+
+    // cut at roughly equal offsets, each moved forward to the start of the next line, so every
+    // line belongs to exactly one range
+    std::vector<const char*> starts(ranges + 1, end);
+    starts[0] = data;
+    for (size_t r = 1; r < ranges; ++r) {
+        const char* cut = std::max(data + size * r / ranges, starts[r - 1]);
+        const char* newline = find_newline(cut, end);
+        starts[r] = newline == end ? end : newline + 1;
+    }
+
+    std::vector<std::vector<CsvRecord>> parts(ranges);
+    parallel_chunks(ranges, [&](size_t r) {
+        parse_range(starts[r], starts[r + 1], delimiter, parts[r]);
+    });
+    size_t total = records.size();
+    for (const auto& part : parts) total += part.size();
+    records.reserve(total);
+    for (const auto& part : parts) records.insert(records.end(), part.begin(), part.end());
+}
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace bpe {
+
+/// <summary>
+/// One line of a delimited file, split at the first delimiter. Both fields point into the caller's
+/// buffer (e.g. a MappedFile), nothing is copied.
+/// </summary>
+struct CsvRecord {
+    std::string_view label;
+    std::string_view text;
+};
+
+/// <summary>
+/// First '\n' in [begin, end), or end. Compares 32 (AVX2) or 16 (SSE2) bytes per step.
+/// </summary>
+const char* find_newline(const char* begin, const char* end);
+
+/// <summary>
+/// Splits data into lines and each line at its first delimiter, appending records in file order.
+/// Empty lines and lines without the delimiter are skipped, a trailing '\r' is dropped. Large
+/// inputs are cut into byte ranges at line boundaries and parsed on threads
+/// (0 = one per hardware thread).
+/// </summary>
+void parse_records(const char* data, size_t size, std::string_view delimiter, std::vector<CsvRecord>& records, size_t threads = 0);
+
+}
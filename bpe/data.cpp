@@ -8,6 +8,10 @@ void Data::set_feature_vector(const std::vector<uint32_t>& vect) {
     feature_vector = vect;
 }
 
+void Data::set_feature_vector(std::vector<uint32_t>&& vect) {
+    feature_vector = std::move(vect);
+}
+
 void Data::append_to_feature_vector(uint32_t val) {
     feature_vector.push_back(val);
 }
@@ -1,4 +1,6 @@
+#pragma once
 #include <vector>
+#include <cstdint>
 class Data {
     std::vector<uint32_t> feature_vector;
     uint8_t label; // 0 for ham, 1 for spam
@@ -7,6 +9,7 @@ public:
     Data();
     ~Data();
     void set_feature_vector(const std::vector<uint32_t>& vect);
+    void set_feature_vector(std::vector<uint32_t>&& vect);
     void append_to_feature_vector(uint32_t val);
     void set_label(uint8_t val);
 
@@ -1,76 +1,123 @@
 #include "data_handler.h"
 #include <iostream>
-#include <set>
 #include <algorithm>
-#include <direct.h>
-#include <fstream>
+#include <cmath>
 #include <string>
 #include "bpe.h"
+#include "csv_reader.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "trace.h"
+#include <numeric>
 #include <random>
 #include <unordered_map>
 
 
-Data_Handler::Data_Handler() : spam_count(0), ham_count(0) {}
+Data_Handler::Data_Handler()
+	: training_data(dataset, {}), test_data(dataset, {}), validation_data(dataset, {}), spam_count(0), ham_count(0) {}
 Data_Handler::~Data_Handler() {}
 
 /// <summary>
-/// Reads a CSV file containing SMS messages and labels, tokenizes each message using BPE,
-/// and stores the resulting feature vectors and labels in the data_array.
+/// Reads a CSV file containing SMS messages and labels and appends their tokens and labels to dataset.
+/// The first call trains one BPE vocabulary over all of its messages; later calls tokenize against
+/// that same vocabulary, so token IDs stay comparable across every loaded file.
+/// Messages are tokenized on threads (0 uses every hardware thread), each encoding a contiguous
+/// slice into its own columns, which are appended in order so dataset keeps file order. Tokens are
+/// stored 16 bits wide while the vocabulary fits (the dataset only ever widens, never narrows).
+/// The file is memory mapped and split into lines on threads; labels and texts stay string_views into
+/// the mapping until they are tokenized, so no line is copied.
 /// Each line should be in the format: label<TAB>message, where label is 'ham' or 'spam'.
 /// The feature vector for each message is a vector of BPE token IDs.
 /// </summary>
-void Data_Handler::read_csv(const std::string& path, const std::string& delimiter) {
-	std::ifstream data_file(path.c_str());
-	std::string line;
-	while (std::getline(data_file, line)) {
-		if (line.empty()) continue;
-
-		size_t tab_pos = line.find(delimiter);
-
-		if (tab_pos == std::string::npos) continue;
-
-		std::string label_str = line.substr(0, tab_pos);
-		std::string text = line.substr(tab_pos + delimiter.length());
-		uint8_t label = (label_str == "spam") ? 1 : 0;
-		Data d;
-
-		std::vector<uint32_t>tokens;
-		bpe::PairArray pairs;
-		bpe::Uint32Array tokens_out;
-		bpe::run_bpe(text, pairs, tokens_out);
-		tokens.assign(tokens_out.begin(), tokens_out.end());
-		d.set_feature_vector(tokens);
-
-		d.set_label(label);
-		data_array.push_back(d);
+void Data_Handler::read_csv(const std::string& path, const std::string& delimiter, size_t max_vocab_size, size_t threads) {
+	bpe::MappedFile file;
+	if (!file.open(path)) return;
+	std::vector<std::string_view> texts;
+	std::vector<uint8_t> labels;
+	{
+		trace::ScopedTimer timer("load.read");
+		std::vector<bpe::CsvRecord> records;
+		bpe::parse_records(file.data(), file.size(), delimiter, records, threads);
+		texts.resize(records.size());
+		labels.resize(records.size());
+		for (size_t i = 0; i < records.size(); ++i) {
+			texts[i] = records[i].text;
+			labels[i] = (records[i].label == "spam") ? 1 : 0;
+		}
 	}
+	trace::counter("load.bytes", static_cast<double>(file.size()));
+	trace::counter("load.messages", static_cast<double>(texts.size()));
+
+	// learn the vocabulary once so token IDs are comparable across messages and files
+	if (tokenizer.get_vocab_size() == 0) {
+		trace::ScopedTimer timer("load.train_vocab");
+		tokenizer.train(texts, max_vocab_size, train_options);
+		tokenizer.save("lookup_table.txt");
+		tokenizer.save_binary("lookup_table.bin");
+	}
+
+	const bpe::TokenWidth width = bpe::token_width_for(tokenizer.get_vocab_size());
+	if (dataset.empty() || width == bpe::TokenWidth::Bits32) dataset.set_width(width);
+
+	const size_t first = dataset.size();
+	bpe::with_token_type(dataset.get_width(), [&](auto tag) {
+		using Token = decltype(tag);
+		{
+			trace::ScopedTimer timer("load.tokenize");
+			size_t chunks = std::max<size_t>(1, std::min(bpe::resolve_thread_count(threads), texts.size() / 256));
+			std::vector<Dataset> parts(chunks, Dataset(dataset.get_width()));
+			bpe::parallel_chunks(chunks, [&](size_t c) {
+				size_t begin = texts.size() * c / chunks;
+				size_t end = texts.size() * (c + 1) / chunks;
+				std::vector<Token> tokens;
+				for (size_t i = begin; i < end; ++i) {
+					tokenizer.encode(texts[i], tokens);
+					parts[c].add(tokens, labels[i]);
+				}
+			});
+			// a part may have widened itself; append converts it to the dataset's width or widens the dataset
+			for (const auto& part : parts) dataset.append(part);
+		}
+		trace::counter("load.dataset_bytes", static_cast<double>(dataset.memory_bytes()));
+	});
+
+	// index only the new messages, message IDs in corpus_index are positions in dataset
+	trace::ScopedTimer timer("load.index");
+	bpe::with_token_type(dataset.get_width(), [&](auto tag) {
+		using Token = decltype(tag);
+		for (size_t i = first; i < dataset.size(); ++i) {
+			const BasicMessageView<Token> m = dataset.message<Token>(i);
+			corpus_index.add(m.tokens, m.count);
+		}
+	});
 }
 
 /// <summary>
-///  Randomly divide the loaded dataset (data_array) into three separate subsets: training_data, test_data, and validation_data. 
+///  Randomly divide the loaded dataset into three separate subsets: training_data, test_data, and validation_data.
+/// The splits are index views, no message is copied. Each split's indices are kept ascending so a pass over
+/// a split reads the token buffer front to back.
 /// </summary>
 void Data_Handler::split_data(float train_percent, float test_percent, float valid_percent) {
-	std::vector<int> indices(data_array.size());
-	for (int i = 0; i < data_array.size(); ++i) {
-		indices[i] = i;
-	}
+	std::vector<uint32_t> indices(dataset.size());
+	std::iota(indices.begin(), indices.end(), 0);
 	std::random_device rd;
 	std::mt19937 g(rd());
 	std::shuffle(indices.begin(), indices.end(), g);
 
-	int train_size = static_cast<int>(data_array.size() * train_percent);
-	int test_size = static_cast<int>(data_array.size() * test_percent);
-	int valid_size = static_cast<int>(data_array.size() * valid_percent);
+	size_t train_size = static_cast<size_t>(dataset.size() * train_percent);
+	size_t test_size = static_cast<size_t>(dataset.size() * test_percent);
+	size_t valid_size = static_cast<size_t>(dataset.size() * valid_percent);
 
-	for (int i = 0; i < train_size; ++i) {
-		training_data.push_back(data_array[indices[i]]);
-	}
-	for (int i = train_size; i < train_size + test_size; ++i) {
-		test_data.push_back(data_array[indices[i]]);
-	}
-	for (int i = train_size + test_size; i < train_size + test_size + valid_size; ++i) {
-		validation_data.push_back(data_array[indices[i]]);
-	}
+	auto take = [&](size_t begin, size_t end) {
+		std::vector<uint32_t> part(indices.begin() + begin, indices.begin() + end);
+		std::sort(part.begin(), part.end());
+		return DatasetView(dataset, std::move(part));
+	};
+	training_data = take(0, train_size);
+	test_data = take(train_size, train_size + test_size);
+	validation_data = take(train_size + test_size, train_size + test_size + valid_size);
+
+	feature_selector.fit(training_data);
 
 	std::cout << "Training data size: " << training_data.size() << std::endl;
 	std::cout << "Test data size: " << test_data.size() << std::endl;
@@ -113,36 +160,31 @@ std::vector<float> Data_Handler::pad_or_truncate(const std::vector<uint32_t>& in
 /// The embedding size can change but for now it's fine at 32.
 /// </summary>
 std::vector<float> Data_Handler::embed_and_average(const std::vector<uint32_t>& input, size_t embedding_size) const {
-	static std::unordered_map<uint32_t, std::vector<float>> embedding_matrix;
-	static bool initialized = false;
-	if (!initialized) {
-		// create embedding matrix with random vectors for each token ID
-		uint32_t max_token = 0;
-		for (const auto& d : data_array) {
-			for (auto t : d.get_feature_vector()) {
-				if (t > max_token) max_token = t;
-			}
-		}
-		std::mt19937 gen(42);
-		std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
-		for (uint32_t i = 0; i <= max_token; ++i) {
-			std::vector<float> emb(embedding_size);
-			for (size_t j = 0; j < embedding_size; ++j) emb[j] = dis(gen);
-			embedding_matrix[i] = emb;
-		}
-		initialized = true;
-	}
+	return get_embeddings(embedding_size).embed_and_average(input);
+}
 
-	// look up embeddings for each token in the message
-	std::vector<float> result(embedding_size, 0.0f);
-	if (input.empty()) return result;
-	for (auto t : input) {
-		const auto& emb = embedding_matrix[t];
-		for (size_t j = 0; j < embedding_size; ++j) result[j] += emb[j];
+/// <summary>
+/// Returns the token embedding table of embedding_size columns, building it on first use. Each size
+/// gets its own table, so callers asking for different sizes never share rows. Every token ID in the
+/// vocabulary (and in the loaded data) gets a row of random values; a built table is only read and
+/// stays at the same address, so this is safe to call from several threads. add_training_message
+/// grows the cached tables when a message brings a token past their last row.
+/// </summary>
+const EmbeddingTable& Data_Handler::get_embeddings(size_t embedding_size) const {
+	std::lock_guard<std::mutex> lock(embeddings_mutex);
+	std::unique_ptr<EmbeddingTable>& table = embeddings[embedding_size];
+	if (!table) {
+		table.reset(new EmbeddingTable());
+		table->init_random(embedding_rows(), embedding_size, 42);
 	}
-	// now average the embeddings to get a single vector for the message
-	for (size_t j = 0; j < embedding_size; ++j) result[j] /= input.size();
-	return result;
+	return *table;
+}
+
+// One row per vocabulary token and per token ID seen in the loaded data
+size_t Data_Handler::embedding_rows() const {
+	size_t rows = tokenizer.get_vocab_size();
+	if (corpus_index.get_vocab_size() > 0) rows = std::max(rows, static_cast<size_t>(corpus_index.get_max_token()) + 1);
+	return rows;
 }
 
 /// <summary>
@@ -181,105 +223,63 @@ float Data_Handler::cosine_similarity(const std::vector<float>& vec1, const std:
 /// between observed and expected occurrences in spam and ham, selecting those with the largest differences
 /// </summary>
 std::vector<uint32_t> Data_Handler::select_features_chi_square(size_t top_n) const {
-	// chi_sqr = sum observed-expected)^2 / expected
-	size_t ham_total = 0, spam_total = 0;
-	count_ham_spam(training_data, ham_total, spam_total);
-
-	std::unordered_map<uint32_t, size_t> spam_with_feature;
-	std::unordered_map<uint32_t, size_t> ham_with_feature;
-	std::set<uint32_t> all_features_seen;
-
-
-	// track unique features for each ham and spam
-	for (const auto& message : training_data) {
-		std::set<uint32_t> unique_features_in_message(message.get_feature_vector().begin(), message.get_feature_vector().end());
-		for (auto feature : unique_features_in_message) {
-			if (message.get_label() == 1) {
-				spam_with_feature[feature]++;
-			}
-			else {
-				ham_with_feature[feature]++;
-			}
-			all_features_seen.insert(feature);
-		}
-	}
-
-	// calculate chi-square for each feature
-	struct FeatureScore {
-		uint32_t feature;
-		double chi_sqr;
-		bool operator<(const FeatureScore& other) const {
-			return chi_sqr > other.chi_sqr; 
-		}
-	};
-
-	std::vector<FeatureScore> scores;
-	for (const auto& feature : all_features_seen) {
-		size_t A = spam_with_feature[feature];
-		size_t B = ham_with_feature[feature];
-		size_t C = spam_total - A;
-		size_t D = ham_total - B;
-
-		double total = spam_total + ham_total;
-		double expected_A = (A + B) * spam_total / total;
-		double expected_B = (A + B) * ham_total / total;
-		double expected_C = (C + D) * spam_total / total;
-		double expected_D = (C + D) * ham_total / total;
-
-		double chi_sqr = 0.0; 
-		if (expected_A > 0) chi_sqr += ((A - expected_A) * (A - expected_A)) / expected_A;
-		if (expected_B > 0) chi_sqr += ((B - expected_B) * (B - expected_B)) / expected_B;
-		if (expected_C > 0) chi_sqr += ((C - expected_C) * (C - expected_C)) / expected_C;
-		if (expected_D > 0) chi_sqr += ((D - expected_D) * (D - expected_D)) / expected_D;
-
-		scores.push_back({ feature, chi_sqr });
-	}	
-
-	std::sort(scores.begin(), scores.end());
+	return feature_selector.select(top_n);
+}
 
-	std::vector<uint32_t> top_features;
-	for (size_t i = 0; i < std::min(top_n, scores.size()); i++)
-	{
-		top_features.push_back(scores[i].feature);
+/// <summary>
+/// Adds a newly labelled message to the dataset and the training set, updating the corpus index
+/// and the chi-square counts without rescanning the existing data. Cached embedding tables that are
+/// too short for the new tokens are rebuilt with more rows; init_random draws row by row from the
+/// same seed, so existing rows keep their values, but row pointers taken earlier are invalidated.
+/// </summary>
+void Data_Handler::add_training_message(const Data& message) {
+	uint32_t index = dataset.add(message);
+	corpus_index.add(message.get_feature_vector());
+	training_data.push_back(index);
+	feature_selector.add(message);
+
+	std::lock_guard<std::mutex> lock(embeddings_mutex);
+	const size_t rows = embedding_rows();
+	for (auto& entry : embeddings) {
+		if (entry.second && entry.second->get_rows() < rows) entry.second->init_random(rows, entry.first, 42);
 	}
-
-	return top_features;
 }
 
-
-
 /// <summary>
 /// Counts the number of ham and spam samples in the given data vector.
 /// </summary>
-void Data_Handler::count_ham_spam(const std::vector<Data>& data, size_t& ham_count, size_t& spam_count) const {
+void Data_Handler::count_ham_spam(const DatasetView& data, size_t& ham_count, size_t& spam_count) const {
 	ham_count = 0;
 	spam_count = 0;
-	for (const auto& d : data) {
-		if (d.get_label() == 1) spam_count++;
+	for (size_t i = 0; i < data.size(); ++i) {
+		if (data.get_label(i) == 1) spam_count++;
 		else ham_count++;
 	}
 }
 
-const std::vector<Data>& Data_Handler::get_training_data() const {
+const Dataset& Data_Handler::get_dataset() const {
+	return dataset;
+}
+const DatasetView& Data_Handler::get_training_data() const {
 	return training_data;
 }
-const std::vector<Data>& Data_Handler::get_test_data() const {
+const DatasetView& Data_Handler::get_test_data() const {
 	return test_data;
 }
-const std::vector<Data>& Data_Handler::get_validation_data() const {
+const DatasetView& Data_Handler::get_validation_data() const {
 	return validation_data;
 }
+const bpe::Tokenizer& Data_Handler::get_tokenizer() const {
+	return tokenizer;
+}
+const CorpusIndex& Data_Handler::get_corpus_index() const {
+	return corpus_index;
+}
 
 size_t Data_Handler::get_total_samples() const {
-	return data_array.size();
+	return dataset.size();
 }
 
 size_t Data_Handler::get_vocabulary_size() const {
-	std::set<uint32_t> unique_tokens;
-	for (const auto& d : data_array) {
-		for (auto token : d.get_feature_vector()) {
-			unique_tokens.insert(token);
-		}
-	}
-	return unique_tokens.size();
+	return corpus_index.get_vocab_size();
 }
\ No newline at end of file
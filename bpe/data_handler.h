@@ -1,13 +1,28 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <map>
+#include <memory>
+#include <mutex>
 #include "data.h"
+#include "dataset.h"
+#include "tokenizer.h"
+#include "embedding_table.h"
+#include "chi_square.h"
+#include "corpus_index.h"
 
 class Data_Handler {
-    std::vector<Data> data_array;
-    std::vector<Data> training_data;
-    std::vector<Data> test_data;
-    std::vector<Data> validation_data;
+    bpe::Tokenizer tokenizer;
+    Dataset dataset;              // every loaded message, in file order
+    DatasetView training_data;    // splits are index views into dataset
+    DatasetView test_data;
+    DatasetView validation_data;
+    CorpusIndex corpus_index; // posting lists and statistics over dataset
+    ChiSquareSelector feature_selector; // document frequencies of training_data
+    mutable std::map<size_t, std::unique_ptr<EmbeddingTable>> embeddings; // one table per embedding size
+    mutable std::mutex embeddings_mutex;
+
+    size_t embedding_rows() const;
 
 
 public:
@@ -16,13 +31,17 @@ public:
 
     size_t spam_count = 0;
     size_t ham_count = 0;
+    bpe::TrainOptions train_options; // how read_csv learns the vocabulary
 
-    void read_csv(const std::string& path, const std::string& delimiter = "\t");
+    void read_csv(const std::string& path, const std::string& delimiter = "\t", size_t max_vocab_size = 0, size_t threads = 0);
     void split_data(float train_percent = 0.7f, float test_percent = 0.2f, float valid_percent = 0.1f);
 
-    const std::vector<Data>& get_training_data() const;
-    const std::vector<Data>& get_test_data() const;
-    const std::vector<Data>& get_validation_data() const;
+    const Dataset& get_dataset() const;
+    const DatasetView& get_training_data() const;
+    const DatasetView& get_test_data() const;
+    const DatasetView& get_validation_data() const;
+    const bpe::Tokenizer& get_tokenizer() const;
+    const CorpusIndex& get_corpus_index() const;
     
 
     size_t get_total_samples() const;
@@ -30,16 +49,18 @@ public:
 
     std::vector<float> pad_or_truncate(const std::vector<uint32_t>& input, size_t fixed_size) const;
     std::vector<float> embed_and_average(const std::vector<uint32_t>& input, size_t embedding_size) const;
+    const EmbeddingTable& get_embeddings(size_t embedding_size) const;
     
     void print_class_distribution() const;
     bool is_training_imbalanced(float threshold = 0.3f);
     
     std::vector<uint32_t> select_features_chi_square(size_t top_n) const;
+    void add_training_message(const Data& message);
 
     /// <summary>
-    /// Counts the number of ham and spam samples in the given data vector.
+    /// Counts the number of ham and spam samples in the given data view.
     /// </summary>
-    void count_ham_spam(const std::vector<Data>& data, size_t& ham_count, size_t& spam_count) const;
+    void count_ham_spam(const DatasetView& data, size_t& ham_count, size_t& spam_count) const;
 
     /// <summary>
     /// Calculate the cosine similarity between two embedding vectors.
@@ -0,0 +1,176 @@
+#include "dataset.h"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+Dataset::Dataset(bpe::TokenWidth width) : width(width), offsets(1, 0) {}
+
+bool Dataset::set_width(bpe::TokenWidth new_width) {
+    if (new_width == width) return true;
+    if (new_width == bpe::TokenWidth::Bits32) {
+        tokens32.assign(tokens16.begin(), tokens16.end());
+        std::vector<uint16_t>().swap(tokens16);
+    }
+    else {
+        // never truncate: a token that needs 32 bits keeps the dataset at 32 bits
+        if (std::any_of(tokens32.begin(), tokens32.end(), [](uint32_t t) { return t > UINT16_MAX; })) return false;
+        tokens16.resize(tokens32.size());
+        std::transform(tokens32.begin(), tokens32.end(), tokens16.begin(), [](uint32_t t) { return static_cast<uint16_t>(t); });
+        std::vector<uint32_t>().swap(tokens32);
+    }
+    width = new_width;
+    return true;
+}
+
+bpe::TokenWidth Dataset::get_width() const {
+    return width;
+}
+
+void Dataset::clear() {
+    tokens16.clear();
+    tokens32.clear();
+    offsets.assign(1, 0);
+    labels.clear();
+}
+
+void Dataset::reserve(size_t messages, size_t total_tokens) {
+    if (width == bpe::TokenWidth::Bits16) tokens16.reserve(total_tokens);
+    else tokens32.reserve(total_tokens);
+    offsets.reserve(messages + 1);
+    labels.reserve(messages);
+}
+
+template<class Token>
+uint32_t Dataset::add(const Token* message_tokens, size_t count, uint8_t label) {
+    const uint32_t index = static_cast<uint32_t>(labels.size());
+    if (width == bpe::TokenWidth::Bits16) {
+        if (sizeof(Token) > sizeof(uint16_t) && std::any_of(message_tokens, message_tokens + count, [](Token t) { return t > UINT16_MAX; })) {
+            set_width(bpe::TokenWidth::Bits32);
+            return add(message_tokens, count, label);
+        }
+        for (size_t i = 0; i < count; ++i) tokens16.push_back(static_cast<uint16_t>(message_tokens[i]));
+    }
+    else {
+        tokens32.insert(tokens32.end(), message_tokens, message_tokens + count);
+    }
+    offsets.push_back(get_token_count());
+    labels.push_back(label);
+    return index;
+}
+
+template<class Token>
+uint32_t Dataset::add(const std::vector<Token>& message_tokens, uint8_t label) {
+    return add(message_tokens.data(), message_tokens.size(), label);
+}
+
+uint32_t Dataset::add(const Data& message) {
+    return add(message.get_feature_vector(), message.get_label());
+}
+
+void Dataset::append(const Dataset& other) {
+    const size_t base = get_token_count();
+    if (width == bpe::TokenWidth::Bits16 && other.width == bpe::TokenWidth::Bits32) {
+        // other may hold tokens that need 32 bits, and its tokens fit when it is narrowed
+        if (std::any_of(other.tokens32.begin(), other.tokens32.end(), [](uint32_t t) { return t > UINT16_MAX; })) set_width(bpe::TokenWidth::Bits32);
+    }
+    if (width == bpe::TokenWidth::Bits16) {
+        tokens16.insert(tokens16.end(), other.tokens16.begin(), other.tokens16.end());
+        for (uint32_t t : other.tokens32) tokens16.push_back(static_cast<uint16_t>(t));
+    }
+    else {
+        tokens32.insert(tokens32.end(), other.tokens16.begin(), other.tokens16.end());
+        tokens32.insert(tokens32.end(), other.tokens32.begin(), other.tokens32.end());
+    }
+    offsets.reserve(offsets.size() + other.size());
+    for (size_t i = 1; i < other.offsets.size(); ++i) offsets.push_back(base + other.offsets[i]);
+    labels.insert(labels.end(), other.labels.begin(), other.labels.end());
+}
+
+size_t Dataset::size() const {
+    return labels.size();
+}
+
+bool Dataset::empty() const {
+    return labels.empty();
+}
+
+size_t Dataset::get_token_count() const {
+    return width == bpe::TokenWidth::Bits16 ? tokens16.size() : tokens32.size();
+}
+
+size_t Dataset::memory_bytes() const {
+    return tokens16.capacity() * sizeof(uint16_t) + tokens32.capacity() * sizeof(uint32_t)
+        + offsets.capacity() * sizeof(size_t) + labels.capacity();
+}
+
+template<>
+MessageView16 Dataset::message<uint16_t>(size_t i) const {
+    if (width != bpe::TokenWidth::Bits16) throw std::logic_error("Dataset::message<uint16_t> on a 32-bit dataset");
+    return { tokens16.data() + offsets[i], offsets[i + 1] - offsets[i], labels[i] };
+}
+
+template<>
+MessageView Dataset::message<uint32_t>(size_t i) const {
+    if (width != bpe::TokenWidth::Bits32) throw std::logic_error("Dataset::message<uint32_t> on a 16-bit dataset");
+    return { tokens32.data() + offsets[i], offsets[i + 1] - offsets[i], labels[i] };
+}
+
+uint8_t Dataset::get_label(size_t i) const {
+    return labels[i];
+}
+
+template uint32_t Dataset::add<uint16_t>(const uint16_t*, size_t, uint8_t);
+template uint32_t Dataset::add<uint32_t>(const uint32_t*, size_t, uint8_t);
+template uint32_t Dataset::add<uint16_t>(const std::vector<uint16_t>&, uint8_t);
+template uint32_t Dataset::add<uint32_t>(const std::vector<uint32_t>&, uint8_t);
+
+DatasetView::DatasetView() {}
+
+DatasetView::DatasetView(const Dataset& dataset, std::vector<uint32_t> indices)
+    : dataset(&dataset), indices(std::move(indices)) {}
+
+DatasetView DatasetView::all(const Dataset& dataset) {
+    std::vector<uint32_t> indices(dataset.size());
+    std::iota(indices.begin(), indices.end(), 0);
+    return DatasetView(dataset, std::move(indices));
+}
+
+void DatasetView::clear() {
+    indices.clear();
+}
+
+void DatasetView::push_back(uint32_t index) {
+    indices.push_back(index);
+}
+
+size_t DatasetView::size() const {
+    return indices.size();
+}
+
+bool DatasetView::empty() const {
+    return indices.empty();
+}
+
+bpe::TokenWidth DatasetView::get_width() const {
+    return dataset ? dataset->get_width() : bpe::TokenWidth::Bits32;
+}
+
+template<class Token>
+BasicMessageView<Token> DatasetView::message(size_t i) const {
+    return dataset->message<Token>(indices[i]);
+}
+
+uint8_t DatasetView::get_label(size_t i) const {
+    return dataset->get_label(indices[i]);
+}
+
+uint32_t DatasetView::get_index(size_t i) const {
+    return indices[i];
+}
+
+const std::vector<uint32_t>& DatasetView::get_indices() const {
+    return indices;
+}
+
+template MessageView16 DatasetView::message<uint16_t>(size_t) const;
+template MessageView DatasetView::message<uint32_t>(size_t) const;
@@ -0,0 +1,113 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "bpe.h"
+#include "data.h"
+
+/// <summary>
+/// One message of a Dataset. tokens points into the dataset's token buffer, so it is only valid
+/// until the dataset is next modified.
+/// </summary>
+template<class Token>
+struct BasicMessageView {
+    const Token* tokens;
+    size_t count;
+    uint8_t label; // 0 for ham, 1 for spam
+};
+
+using MessageView = BasicMessageView<uint32_t>;
+using MessageView16 = BasicMessageView<uint16_t>;
+
+/// <summary>
+/// Columnar message store: the tokens of every message in one contiguous buffer, an offsets array
+/// marking where each message starts and one label byte per message. Message i is
+/// tokens[offsets[i], offsets[i + 1]). One allocation per column instead of one per message, and a
+/// pass over the messages is a linear scan of the buffer.
+/// Tokens are stored as uint16_t or uint32_t (get_width()); passes over the data pick the matching
+/// Token type once with bpe::with_token_type and read message&lt;Token&gt;(i).
+/// </summary>
+class Dataset {
+    bpe::TokenWidth width;
+    std::vector<uint16_t> tokens16; // used when width is Bits16
+    std::vector<uint32_t> tokens32; // used when width is Bits32
+    std::vector<size_t> offsets;    // size() + 1 entries, offsets[0] = 0
+    std::vector<uint8_t> labels;
+
+public:
+    explicit Dataset(bpe::TokenWidth width = bpe::TokenWidth::Bits32);
+
+    /// <summary>
+    /// Changes the stored token width, converting the messages already stored. Narrowing to
+    /// 16 bits is refused, returning false and leaving the dataset unchanged, if a stored token
+    /// does not fit.
+    /// </summary>
+    bool set_width(bpe::TokenWidth new_width);
+    bpe::TokenWidth get_width() const;
+
+    void clear();
+    void reserve(size_t messages, size_t total_tokens);
+
+    /// <summary>
+    /// Appends one message and returns its index. A 16-bit dataset widens itself first if a
+    /// token does not fit.
+    /// </summary>
+    template<class Token>
+    uint32_t add(const Token* message_tokens, size_t count, uint8_t label);
+    template<class Token>
+    uint32_t add(const std::vector<Token>& message_tokens, uint8_t label);
+    uint32_t add(const Data& message);
+
+    /// <summary>
+    /// Appends every message of other, in order. Tokens are converted to this dataset's width,
+    /// which widens first if other holds a token that does not fit in 16 bits.
+    /// </summary>
+    void append(const Dataset& other);
+
+    size_t size() const;
+    bool empty() const;
+    size_t get_token_count() const;
+    size_t memory_bytes() const;
+
+    /// <summary>
+    /// Message i read as Token, which must match get_width(); a mismatch throws std::logic_error.
+    /// </summary>
+    template<class Token = uint32_t>
+    BasicMessageView<Token> message(size_t i) const;
+    uint8_t get_label(size_t i) const;
+};
+
+template<>
+MessageView16 Dataset::message<uint16_t>(size_t i) const;
+template<>
+MessageView Dataset::message<uint32_t>(size_t i) const;
+
+/// <summary>
+/// A subset of a Dataset's messages by index, e.g. a train/test split. Holds indices only, the
+/// dataset must outlive the view. Ascending indices keep scans moving forward through the buffer.
+/// </summary>
+class DatasetView {
+    const Dataset* dataset = nullptr;
+    std::vector<uint32_t> indices;
+
+public:
+    DatasetView();
+    DatasetView(const Dataset& dataset, std::vector<uint32_t> indices);
+
+    /// <summary>
+    /// Every message of dataset, in order.
+    /// </summary>
+    static DatasetView all(const Dataset& dataset);
+
+    void clear();
+    void push_back(uint32_t index);
+
+    size_t size() const;
+    bool empty() const;
+    bpe::TokenWidth get_width() const;
+    template<class Token = uint32_t>
+    BasicMessageView<Token> message(size_t i) const;
+    uint8_t get_label(size_t i) const;
+    uint32_t get_index(size_t i) const; // position of message i in the dataset
+    const std::vector<uint32_t>& get_indices() const;
+};
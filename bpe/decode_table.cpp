@@ -0,0 +1,99 @@
+#include "decode_table.h"
+#include "binary_vocab.h"
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+namespace bpe {
+
+DecodeTable::DecodeTable() {}
+
+DecodeTable::DecodeTable(const PairArray& pairs) {
+    if (!build_expansions(pairs, owned_offsets, owned_bytes)) {
+        std::cerr << "Error: Cannot build decode table, pair refers to an undefined token" << std::endl;
+        owned_offsets.clear();
+        owned_bytes.clear();
+    }
+    owned_bytes.resize(owned_bytes.size() + COPY_WIDTH, 0);
+    bind_owned();
+}
+
+DecodeTable::DecodeTable(const MappedVocab& vocab)
+    : offsets(vocab.offsets()), bytes(vocab.bytes()), count(vocab.size()) {}
+
+DecodeTable::DecodeTable(const DecodeTable& other) {
+    *this = other;
+}
+
+DecodeTable& DecodeTable::operator=(const DecodeTable& other) {
+    if (this == &other) return *this;
+    owned_offsets = other.owned_offsets;
+    owned_bytes = other.owned_bytes;
+    if (other.offsets == other.owned_offsets.data()) {
+        bind_owned();
+    }
+    else {
+        offsets = other.offsets;
+        bytes = other.bytes;
+        count = other.count;
+        padded = false;
+    }
+    return *this;
+}
+
+void DecodeTable::bind_owned() {
+    offsets = owned_offsets.data();
+    bytes = owned_bytes.data();
+    count = owned_offsets.empty() ? 0 : owned_offsets.size() - 1;
+    padded = true;
+}
+
+size_t DecodeTable::size() const {
+    return count;
+}
+
+size_t DecodeTable::token_length(uint32_t token) const {
+    assert(token < count);
+    return static_cast<size_t>(offsets[token + 1] - offsets[token]);
+}
+
+const char* DecodeTable::token_bytes(uint32_t token) const {
+    assert(token < count);
+    return bytes + offsets[token];
+}
+
+size_t DecodeTable::decoded_size(const Uint32Array& tokens) const {
+    size_t total = 0;
+    for (uint32_t t : tokens) {
+        total += token_length(t);
+    }
+    return total;
+}
+
+size_t DecodeTable::decode(const Uint32Array& tokens, char* out, size_t capacity) const {
+    size_t total = decoded_size(tokens);
+    if (total > capacity) return total;
+    char* end = out + capacity;
+    for (uint32_t t : tokens) {
+        size_t len = static_cast<size_t>(offsets[t + 1] - offsets[t]);
+        if (padded && len <= COPY_WIDTH && static_cast<size_t>(end - out) >= COPY_WIDTH) {
+            // the extra bytes land where the next token goes and get overwritten
+            std::memcpy(out, bytes + offsets[t], COPY_WIDTH);
+        }
+        else {
+            std::memcpy(out, bytes + offsets[t], len);
+        }
+        out += len;
+    }
+    return total;
+}
+
+void DecodeTable::decode(const Uint32Array& tokens, std::string& out) const {
+    size_t total = decoded_size(tokens);
+    // slack at the end lets the last tokens use the fixed width copy too
+    out.resize(total + COPY_WIDTH);
+    decode(tokens, &out[0], out.size());
+    out.resize(total);
+}
+
+}
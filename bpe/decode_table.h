@@ -0,0 +1,58 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "bpe.h"
+
+namespace bpe {
+
+class MappedVocab;
+
+/// <summary>
+/// Every token's byte expansion computed once into one contiguous arena. Token i expands to
+/// bytes[offsets[i] .. offsets[i + 1]), so decoding is a length sum and a memcpy per token.
+/// The table either owns its arena or views the one stored in a MappedVocab.
+/// </summary>
+class DecodeTable {
+    // short tokens are copied with one fixed width memcpy when the arena and output allow it
+    static const size_t COPY_WIDTH = 16;
+
+    std::vector<uint64_t> owned_offsets;
+    std::vector<char> owned_bytes;
+    const uint64_t* offsets = nullptr;
+    const char* bytes = nullptr;
+    size_t count = 0;
+    bool padded = false; // the arena can be over-read by COPY_WIDTH bytes
+
+    void bind_owned();
+
+public:
+    DecodeTable();
+    explicit DecodeTable(const PairArray& pairs);
+    // the MappedVocab must stay open while the table is in use
+    explicit DecodeTable(const MappedVocab& vocab);
+    DecodeTable(const DecodeTable& other);
+    DecodeTable& operator=(const DecodeTable& other);
+
+    size_t size() const;
+    size_t token_length(uint32_t token) const;
+    const char* token_bytes(uint32_t token) const;
+
+    /// <summary>
+    /// Number of bytes the token stream decodes to.
+    /// </summary>
+    size_t decoded_size(const Uint32Array& tokens) const;
+
+    /// <summary>
+    /// Decodes into a caller provided buffer. Returns the decoded size; nothing is written if
+    /// that is larger than capacity. Bytes past the decoded size, up to capacity, may be overwritten.
+    /// </summary>
+    size_t decode(const Uint32Array& tokens, char* out, size_t capacity) const;
+
+    /// <summary>
+    /// Decodes into out, reusing its capacity.
+    /// </summary>
+    void decode(const Uint32Array& tokens, std::string& out) const;
+};
+
+}
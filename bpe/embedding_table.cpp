@@ -0,0 +1,121 @@
+#include "embedding_table.h"
+#include <algorithm>
+#include <new>
+#include <random>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+void EmbeddingTable::AlignedFree::operator()(float* p) const {
+    ::operator delete[](p, std::align_val_t(ALIGNMENT));
+}
+
+EmbeddingTable::EmbeddingTable() {}
+EmbeddingTable::~EmbeddingTable() {}
+
+void EmbeddingTable::init_random(size_t row_count, size_t embedding_size, uint32_t seed) {
+    rows = row_count;
+    dim = embedding_size;
+    stride = stride_for(embedding_size);
+    data.reset(static_cast<float*>(::operator new[](std::max<size_t>(1, rows * stride) * sizeof(float), std::align_val_t(ALIGNMENT))));
+    values = data.get();
+    std::fill(data.get(), data.get() + rows * stride, 0.0f);
+
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+    for (size_t i = 0; i < rows; ++i) {
+        float* r = data.get() + i * stride;
+        for (size_t j = 0; j < dim; ++j) r[j] = dis(gen);
+    }
+}
+
+void EmbeddingTable::attach(const float* row_values, size_t row_count, size_t embedding_size) {
+    data.reset();
+    values = row_values;
+    rows = row_count;
+    dim = embedding_size;
+    stride = stride_for(embedding_size);
+}
+
+size_t EmbeddingTable::stride_for(size_t embedding_size) {
+    return (embedding_size + 7) / 8 * 8;
+}
+
+size_t EmbeddingTable::get_rows() const {
+    return rows;
+}
+
+size_t EmbeddingTable::get_dim() const {
+    return dim;
+}
+
+size_t EmbeddingTable::get_stride() const {
+    return stride;
+}
+
+const float* EmbeddingTable::get_data() const {
+    return values;
+}
+
+const float* EmbeddingTable::row(uint32_t token) const {
+    return values + static_cast<size_t>(token) * stride;
+}
+
+// acc[0..stride) += row[0..stride), both aligned and padded so no tail handling is needed
+static inline void accumulate(float* acc, const float* row, size_t stride) {
+#if defined(__AVX2__)
+    for (size_t j = 0; j < stride; j += 8) {
+        _mm256_store_ps(acc + j, _mm256_add_ps(_mm256_load_ps(acc + j), _mm256_load_ps(row + j)));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (size_t j = 0; j < stride; j += 4) {
+        _mm_store_ps(acc + j, _mm_add_ps(_mm_load_ps(acc + j), _mm_load_ps(row + j)));
+    }
+#else
+    for (size_t j = 0; j < stride; ++j) acc[j] += row[j];
+#endif
+}
+
+// Sums the rows of the tokens accepted by keep into an aligned, padded scratch row, then
+// writes their average to out. Returns how many tokens were averaged.
+template<class Token, class Keep>
+static size_t average_rows(const EmbeddingTable& table, const Token* tokens, size_t count, Keep keep, float* out, size_t stride) {
+    thread_local std::vector<float> scratch_storage;
+    scratch_storage.assign(stride + EmbeddingTable::ALIGNMENT / sizeof(float), 0.0f);
+    void* raw = scratch_storage.data();
+    size_t space = scratch_storage.size() * sizeof(float);
+    float* acc = static_cast<float*>(std::align(EmbeddingTable::ALIGNMENT, stride * sizeof(float), raw, space));
+
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (!keep(tokens[i])) continue;
+        ++kept;
+        if (tokens[i] < table.get_rows()) accumulate(acc, table.row(tokens[i]), stride);
+    }
+    const size_t dim = table.get_dim();
+    for (size_t j = 0; j < dim; ++j) out[j] = kept > 0 ? acc[j] / static_cast<float>(kept) : 0.0f;
+    return kept;
+}
+
+template<class Token>
+void EmbeddingTable::embed_and_average(const Token* tokens, size_t count, float* out) const {
+    average_rows(*this, tokens, count, [](uint32_t) { return true; }, out, stride);
+}
+
+template<class Token>
+size_t EmbeddingTable::embed_and_average(const Token* tokens, size_t count, const uint8_t* mask, size_t mask_size, float* out) const {
+    return average_rows(*this, tokens, count, [mask, mask_size](uint32_t t) { return t < mask_size && mask[t] != 0; }, out, stride);
+}
+
+std::vector<float> EmbeddingTable::embed_and_average(const std::vector<uint32_t>& tokens) const {
+    std::vector<float> result(dim, 0.0f);
+    embed_and_average(tokens.data(), tokens.size(), result.data());
+    return result;
+}
+
+template void EmbeddingTable::embed_and_average<uint16_t>(const uint16_t*, size_t, float*) const;
+template void EmbeddingTable::embed_and_average<uint32_t>(const uint32_t*, size_t, float*) const;
+template size_t EmbeddingTable::embed_and_average<uint16_t>(const uint16_t*, size_t, const uint8_t*, size_t, float*) const;
+template size_t EmbeddingTable::embed_and_average<uint32_t>(const uint32_t*, size_t, const uint8_t*, size_t, float*) const;
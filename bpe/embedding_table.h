@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/// <summary>
+/// Token embeddings in one aligned, row-major float buffer indexed directly by token ID.
+/// Rows are padded to a multiple of 8 floats so every row starts on a SIMD boundary.
+/// Reading from several threads is safe once the table is filled. The table either owns its rows
+/// or is a view of rows stored elsewhere, e.g. in a mapped model file.
+/// </summary>
+class EmbeddingTable {
+    struct AlignedFree {
+        void operator()(float* p) const;
+    };
+    std::unique_ptr<float[], AlignedFree> data; // owned rows, empty for a view
+    const float* values = nullptr;              // first row, owned or viewed
+    size_t rows = 0;
+    size_t dim = 0;
+    size_t stride = 0;
+
+public:
+    static const size_t ALIGNMENT = 64;
+
+    EmbeddingTable();
+    ~EmbeddingTable();
+
+    /// <summary>
+    /// Fills rows x dim with uniform random values in [-1, 1), drawn row by row from mt19937(seed).
+    /// </summary>
+    void init_random(size_t row_count, size_t embedding_size, uint32_t seed = 42);
+
+    /// <summary>
+    /// Makes this table a view of row_count rows already laid out with stride_for(embedding_size)
+    /// floats each. values must be ALIGNMENT-aligned and outlive the table.
+    /// </summary>
+    void attach(const float* values, size_t row_count, size_t embedding_size);
+
+    static size_t stride_for(size_t embedding_size);
+    size_t get_rows() const;
+    size_t get_dim() const;
+    size_t get_stride() const;
+    const float* get_data() const; // rows * stride floats
+    const float* row(uint32_t token) const;
+
+    /// <summary>
+    /// Averages the rows of tokens into out (dim floats). Tokens outside the table count as zero
+    /// vectors, an empty message gives all zeros. Token is uint16_t or uint32_t.
+    /// </summary>
+    template<class Token>
+    void embed_and_average(const Token* tokens, size_t count, float* out) const;
+    std::vector<float> embed_and_average(const std::vector<uint32_t>& tokens) const;
+
+    /// <summary>
+    /// Same as above but only averages tokens t with t &lt; mask_size and mask[t] != 0, without
+    /// building a filtered copy. Returns how many tokens passed the mask.
+    /// </summary>
+    template<class Token>
+    size_t embed_and_average(const Token* tokens, size_t count, const uint8_t* mask, size_t mask_size, float* out) const;
+};
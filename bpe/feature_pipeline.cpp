@@ -0,0 +1,86 @@
+#include "feature_pipeline.h"
+#include "parallel.h"
+#include "trace.h"
+#include <algorithm>
+
+FeaturePipeline::FeaturePipeline(const EmbeddingTable& embeddings, const std::vector<uint32_t>& selected_features)
+    : embeddings(&embeddings) {
+    build_mask(selected_features);
+}
+
+FeaturePipeline::FeaturePipeline(const QuantizedEmbeddingTable& embeddings, const std::vector<uint32_t>& selected_features)
+    : quantized(&embeddings) {
+    build_mask(selected_features);
+}
+
+void FeaturePipeline::build_mask(const std::vector<uint32_t>& selected_features) {
+    uint32_t max_feature = 0;
+    for (auto t : selected_features) max_feature = std::max(max_feature, t);
+    mask.assign(selected_features.empty() ? 0 : static_cast<size_t>(max_feature) + 1, 0);
+    for (auto t : selected_features) {
+        if (!mask[t]) ++selected_count;
+        mask[t] = 1;
+    }
+}
+
+bool FeaturePipeline::is_selected(uint32_t token) const {
+    return token < mask.size() && mask[token] != 0;
+}
+
+size_t FeaturePipeline::get_selected_count() const {
+    return selected_count;
+}
+
+size_t FeaturePipeline::get_output_size() const {
+    return quantized ? quantized->get_dim() : embeddings->get_dim();
+}
+
+template<class Token>
+void FeaturePipeline::transform(const Token* tokens, size_t count, float* out) const {
+    if (quantized) quantized->embed_and_average(tokens, count, mask.data(), mask.size(), out);
+    else embeddings->embed_and_average(tokens, count, mask.data(), mask.size(), out);
+}
+
+void FeaturePipeline::transform(const std::vector<uint32_t>& tokens, float* out) const {
+    transform(tokens.data(), tokens.size(), out);
+}
+
+std::vector<float> FeaturePipeline::transform(const std::vector<uint32_t>& tokens) const {
+    std::vector<float> result(get_output_size(), 0.0f);
+    transform(tokens, result.data());
+    return result;
+}
+
+void FeaturePipeline::transform(const DatasetView& data, std::vector<std::vector<float>>& features, std::vector<float>& labels, size_t threads) const {
+    trace::ScopedTimer timer("features.transform", "features");
+    trace::counter("features.messages", static_cast<double>(data.size()));
+    features.assign(data.size(), std::vector<float>(get_output_size(), 0.0f));
+    labels.resize(data.size());
+    bpe::with_token_type(data.get_width(), [&](auto tag) {
+        using Token = decltype(tag);
+        bpe::parallel_for(data.size(), threads, 64, [&](size_t i) {
+            const BasicMessageView<Token> m = data.message<Token>(i);
+            transform(m.tokens, m.count, features[i].data());
+            labels[i] = static_cast<float>(m.label);
+        });
+    });
+}
+
+void FeaturePipeline::transform(const DatasetView& data, std::vector<float>& matrix, std::vector<float>& labels, size_t threads) const {
+    trace::ScopedTimer timer("features.transform", "features");
+    trace::counter("features.messages", static_cast<double>(data.size()));
+    const size_t dim = get_output_size();
+    matrix.assign(data.size() * dim, 0.0f);
+    labels.resize(data.size());
+    bpe::with_token_type(data.get_width(), [&](auto tag) {
+        using Token = decltype(tag);
+        bpe::parallel_for(data.size(), threads, 64, [&](size_t i) {
+            const BasicMessageView<Token> m = data.message<Token>(i);
+            transform(m.tokens, m.count, matrix.data() + i * dim);
+            labels[i] = static_cast<float>(m.label);
+        });
+    });
+}
+
+template void FeaturePipeline::transform<uint16_t>(const uint16_t*, size_t, float*) const;
+template void FeaturePipeline::transform<uint32_t>(const uint32_t*, size_t, float*) const;
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "dataset.h"
+#include "embedding_table.h"
+#include "quantize.h"
+
+/// <summary>
+/// Turns tokenized messages into averaged embeddings over a fixed set of selected features.
+/// The selection is compiled into a dense per-token mask so filtering and embedding happen in one
+/// pass over each message. Reads from a float or a quantized embedding table, which must outlive it.
+/// </summary>
+class FeaturePipeline {
+    const EmbeddingTable* embeddings = nullptr;
+    const QuantizedEmbeddingTable* quantized = nullptr;
+    std::vector<uint8_t> mask; // mask[token] != 0 when the token is selected
+    size_t selected_count = 0;
+
+    void build_mask(const std::vector<uint32_t>& selected_features);
+
+public:
+    FeaturePipeline(const EmbeddingTable& embeddings, const std::vector<uint32_t>& selected_features);
+    FeaturePipeline(const QuantizedEmbeddingTable& embeddings, const std::vector<uint32_t>& selected_features);
+
+    bool is_selected(uint32_t token) const;
+    size_t get_selected_count() const;
+    size_t get_output_size() const;
+
+    /// <summary>
+    /// Writes the average embedding of the selected tokens of one message to out (get_output_size() floats).
+    /// </summary>
+    template<class Token>
+    void transform(const Token* tokens, size_t count, float* out) const;
+    void transform(const std::vector<uint32_t>& tokens, float* out) const;
+    std::vector<float> transform(const std::vector<uint32_t>& tokens) const;
+
+    /// <summary>
+    /// Transforms every message in data, in parallel, filling one feature row and one label per message.
+    /// Works on 16- and 32-bit datasets. threads = 0 uses one thread per hardware thread.
+    /// </summary>
+    void transform(const DatasetView& data, std::vector<std::vector<float>>& features, std::vector<float>& labels, size_t threads = 0) const;
+
+    /// <summary>
+    /// Same, but writes one contiguous row-major matrix of data.size() x get_output_size() floats.
+    /// </summary>
+    void transform(const DatasetView& data, std::vector<float>& matrix, std::vector<float>& labels, size_t threads = 0) const;
+};
@@ -1,19 +1,68 @@
 #include "data_handler.h"
 #include "nn.h"
+#include "feature_pipeline.h"
+#include "quantize.h"
+#include "model.h"
+#include "scoring_server.h"
+#include "similarity.h"
 #include <iostream>
 #include "bpe.h"
+#include "trace.h"
 #include <sstream>
 #include <algorithm>
+#include <string>
 
-int main() {
+int main(int argc, char* argv[]) {
     const size_t INPUT_SIZE = 32;
-    const size_t ITERATIONS = 4000;
+    const size_t ITERATIONS = 1000;     // most mini-batch epochs, early stopping usually ends sooner
+    const size_t BATCH_SIZE = 128;      // rows per step, split across threads at MIN_ROWS_PER_WORKER rows each
+    const float LEARNING_RATE = 1.0f;
+    const size_t MAX_VOCAB_SIZE = 1000; // shared BPE vocabulary incl. 256 base tokens
     size_t TOP_N = 200;
 
+    // --trace <file> writes a Chrome trace, --metrics <file> a flat timing summary,
+    // --verbose prints every BPE merge, --quantize int8|fp16 also scores the test set
+    // with a quantized copy of the embeddings and model, --model <file> skips training and
+    // serves a saved model: one message per stdin line, or per line from clients of
+    // --socket <path>, scored on --workers <n> threads
+    std::string trace_file, metrics_file, quantize, model_file, socket_path;
+    size_t workers = 0;
+    bool verbose = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--trace" && i + 1 < argc) trace_file = argv[++i];
+        else if (arg == "--metrics" && i + 1 < argc) metrics_file = argv[++i];
+        else if (arg == "--quantize" && i + 1 < argc) quantize = argv[++i];
+        else if (arg == "--model" && i + 1 < argc) model_file = argv[++i];
+        else if (arg == "--socket" && i + 1 < argc) socket_path = argv[++i];
+        else if (arg == "--workers" && i + 1 < argc) workers = std::stoul(argv[++i]);
+        else if (arg == "--verbose") verbose = true;
+    }
+    trace::set_enabled(!trace_file.empty() || !metrics_file.empty());
+
+    if (!model_file.empty()) {
+        Model model;
+        if (!model.load(model_file)) return 1;
+        ServerOptions options;
+        options.workers = workers;
+        ScoringServer server(model, options);
+        if (socket_path.empty()) server.serve_stream(std::cin, std::cout);
+        else if (!server.serve_socket(socket_path)) return 1;
+        server.stop();
+        std::cerr << "Served " << server.stats().to_string() << std::endl;
+        if (!trace_file.empty()) trace::write_chrome_trace(trace_file);
+        if (!metrics_file.empty()) trace::write_metrics(metrics_file);
+        return 0;
+    }
+
     // load dataset and preprocess
     Data_Handler dh;
-    dh.read_csv("SMSSpamCollection.txt", "\t");
-    dh.split_data(); 
+    if (verbose) dh.train_options.on_merge = bpe::print_merge;
+    {
+        trace::ScopedTimer timer("load");
+        dh.read_csv("SMSSpamCollection.txt", "\t", MAX_VOCAB_SIZE);
+        dh.split_data();
+    }
 
     // Get vocab size and estimate best TOP_N
 	size_t vocab_size = dh.get_vocabulary_size();
@@ -31,32 +80,23 @@ int main() {
     }
 
     // Select top N features using chi-square
-    std::vector<uint32_t> selected_features = dh.select_features_chi_square(TOP_N);
-    std::vector<std::vector<float>> train_features, test_features;
-    std::vector<float> train_labels, test_labels;
-
-    // prepare training data with embeddings, filtering by selected features
-    for (const auto& d : dh.get_training_data()) {
-        std::vector<uint32_t> filtered;
-        for (auto t : d.get_feature_vector()) {
-            if (std::find(selected_features.begin(), selected_features.end(), t) != selected_features.end()) {
-                filtered.push_back(t);
-            }
-        }
-        train_features.push_back(dh.embed_and_average(filtered, INPUT_SIZE));
-        train_labels.push_back(static_cast<float>(d.get_label()));
+    std::vector<uint32_t> selected_features;
+    {
+        trace::ScopedTimer timer("chi_square");
+        selected_features = dh.select_features_chi_square(TOP_N);
     }
+    std::vector<float> train_matrix; // row-major, one INPUT_SIZE row per training message
+    std::vector<float> validation_matrix;
+    std::vector<float> test_matrix;
+    std::vector<float> train_labels, validation_labels, test_labels;
 
-    // prepare test data with embeddings, filtering by selected features
-    for (const auto& d : dh.get_test_data()) {
-        std::vector<uint32_t> filtered;
-        for (auto t : d.get_feature_vector()) {
-            if (std::find(selected_features.begin(), selected_features.end(), t) != selected_features.end()) {
-                filtered.push_back(t);
-            }
-        }
-        test_features.push_back(dh.embed_and_average(filtered, INPUT_SIZE));
-        test_labels.push_back(static_cast<float>(d.get_label()));
+    {
+        trace::ScopedTimer timer("embedding");
+        // prepare training, validation and test data with embeddings, filtering by selected features
+        FeaturePipeline features(dh.get_embeddings(INPUT_SIZE), selected_features);
+        features.transform(dh.get_training_data(), train_matrix, train_labels);
+        features.transform(dh.get_validation_data(), validation_matrix, validation_labels);
+        features.transform(dh.get_test_data(), test_matrix, test_labels);
     }
 
     // Demonstrate cosine similarity between messages
@@ -80,16 +120,42 @@ int main() {
     }
     
     if (spam_index != -1 && ham_index != -1 && another_spam_index != -1) {
+        auto test_row = [&](int i) {
+            return std::vector<float>(test_matrix.begin() + i * INPUT_SIZE, test_matrix.begin() + (i + 1) * INPUT_SIZE);
+        };
         // Cosine similarity between spam and ham
-        float sim_spam_ham = dh.cosine_similarity(test_features[spam_index], test_features[ham_index]);
+        float sim_spam_ham = dh.cosine_similarity(test_row(spam_index), test_row(ham_index));
         // Cosine similarity between two spam messages
-        float sim_spam_spam = dh.cosine_similarity(test_features[spam_index], test_features[another_spam_index]);
+        float sim_spam_spam = dh.cosine_similarity(test_row(spam_index), test_row(another_spam_index));
         
         std::cout << "Cosine similarity between spam and ham: " << sim_spam_ham << std::endl;
         std::cout << "Cosine similarity between two spam messages: " << sim_spam_spam << std::endl;
         std::cout << "Note: Higher values indicate more similar messages\n";
     }
 
+    // near-duplicate test messages, e.g. one spam campaign sent with small edits
+    // (all tokens, the selected-feature mask leaves too little of a message to compare)
+    {
+        const auto& test_data = dh.get_test_data();
+        const EmbeddingTable& table = dh.get_embeddings(INPUT_SIZE);
+        std::vector<float> averages(test_data.size() * INPUT_SIZE);
+        bpe::with_token_type(test_data.get_width(), [&](auto tag) {
+            using Token = decltype(tag);
+            for (size_t i = 0; i < test_data.size(); ++i) {
+                const BasicMessageView<Token> m = test_data.message<Token>(i);
+                table.embed_and_average(m.tokens, m.count, averages.data() + i * INPUT_SIZE);
+            }
+        });
+        VectorIndex index(INPUT_SIZE);
+        index.add(averages.data(), test_data.size());
+        auto pairs = find_near_duplicates(index, 0.98f);
+        size_t spam_pairs = 0;
+        for (const auto& p : pairs) {
+            if (test_data.get_label(p.a) == 1 && test_data.get_label(p.b) == 1) spam_pairs++;
+        }
+        std::cout << "Near-duplicate test pairs (cosine >= 0.98): " << pairs.size() << ", both spam: " << spam_pairs << std::endl;
+    }
+
     // calculate class weights for weighted loss
     // weights for each class is inversely proportional to its frequency
     float weight_ham = 1.0f, weight_spam = 1.0f; // higher for spam as it's minority class
@@ -102,44 +168,89 @@ int main() {
 
     // train the NN
     NeuralNetwork nn(INPUT_SIZE, ITERATIONS);
-    nn.train(train_features, train_labels, 0.1f, weight_ham, weight_spam);
+    {
+        trace::ScopedTimer timer("training");
+        TrainConfig config;
+        config.batch_size = BATCH_SIZE;
+        config.learning_rate = LEARNING_RATE;
+        config.weight_ham = weight_ham;
+        config.weight_spam = weight_spam;
+        config.threads = 0;
+        config.eval_every = 5;
+        config.patience = 10;
+        config.lr_decay = 0.7f;
+        TrainHistory history = nn.train_scheduled(train_matrix, train_labels, validation_matrix, validation_labels, config);
+        std::cout << "Trained " << history.epochs_run << " epochs"
+            << (history.stopped_early ? " (stopped early)" : "")
+            << ", best validation loss " << history.best_validation_loss
+            << " at epoch " << history.best_epoch << std::endl;
+    }
+    Model::save("model.bin", dh.get_tokenizer(), dh.get_embeddings(INPUT_SIZE), selected_features, nn);
 
     // analyse results
-    size_t correct = 0;
-    for (size_t i = 0; i < test_features.size(); ++i) {
-        float prediction = nn.predict(test_features[i]);
-        int pred_label;
-        if (prediction > 0.5f) {
-            pred_label = 1;
-        } else {
-            pred_label = 0;
+    {
+        trace::ScopedTimer timer("evaluation");
+        std::vector<float> predictions(test_labels.size());
+        nn.predict_batch(test_matrix.data(), test_labels.size(), predictions.data(), 0);
+        size_t correct = 0;
+        for (size_t i = 0; i < predictions.size(); ++i) {
+            float prediction = predictions[i];
+            int pred_label;
+            if (prediction > 0.5f) {
+                pred_label = 1;
+            } else {
+                pred_label = 0;
+            }
+            if (pred_label == static_cast<int>(test_labels[i])) correct++;
         }
-        if (pred_label == static_cast<int>(test_labels[i])) correct++;
-    }
-    std::cout << "\n\n######## Results ########" << std::endl;
-    std::cout << "TOP_N used: " << TOP_N << std::endl;
-    std::cout << "Vocabulary size: " << vocab_size << std::endl;
-    std::cout << "Test accuracy: " << (100.0 * correct / test_features.size()) << "%" << std::endl;
-    size_t tp = 0, tn = 0, fp = 0, fn = 0;
-    for (size_t i = 0; i < test_features.size(); ++i) {
-        float prediction = nn.predict(test_features[i]);
-        int pred_label = (prediction > 0.5f) ? 1 : 0;
-        int true_label = static_cast<int>(test_labels[i]);
-        if (pred_label == 1 && true_label == 1) tp++;
-        else if (pred_label == 0 && true_label == 0) tn++;
-        else if (pred_label == 1 && true_label == 0) fp++;
-        else if (pred_label == 0 && true_label == 1) fn++;
+        std::cout << "\n\n######## Results ########" << std::endl;
+        std::cout << "TOP_N used: " << TOP_N << std::endl;
+        std::cout << "Vocabulary size: " << vocab_size << std::endl;
+        std::cout << "Test accuracy: " << (100.0 * correct / predictions.size()) << "%" << std::endl;
+        size_t tp = 0, tn = 0, fp = 0, fn = 0;
+        for (size_t i = 0; i < predictions.size(); ++i) {
+            float prediction = predictions[i];
+            int pred_label = (prediction > 0.5f) ? 1 : 0;
+            int true_label = static_cast<int>(test_labels[i]);
+            if (pred_label == 1 && true_label == 1) tp++;
+            else if (pred_label == 0 && true_label == 0) tn++;
+            else if (pred_label == 1 && true_label == 0) fp++;
+            else if (pred_label == 0 && true_label == 1) fn++;
+        }
+        std::cout << "\nConfusion Matrix:\n";
+        std::cout << "TP: " << tp << "  FP: " << fp << std::endl;
+        std::cout << "FN: " << fn << "  TN: " << tn << std::endl;
+
+        float precision = (tp + fp) > 0 ? (float)tp / (tp + fp) : 0;
+        float recall = (tp + fn) > 0 ? (float)tp / (tp + fn) : 0;
+        float f1 = (precision + recall) > 0 ? 2 * precision * recall / (precision + recall) : 0;
+
+        std::cout << "Precision: " << precision << std::endl;
+        std::cout << "Recall: " << recall << std::endl;
+        std::cout << "F1 Score: " << f1 << std::endl;
     }
-    std::cout << "\nConfusion Matrix:\n";
-    std::cout << "TP: " << tp << "  FP: " << fp << std::endl;
-    std::cout << "FN: " << fn << "  TN: " << tn << std::endl;
 
-    float precision = (tp + fp) > 0 ? (float)tp / (tp + fp) : 0;
-    float recall = (tp + fn) > 0 ? (float)tp / (tp + fn) : 0;
-    float f1 = (precision + recall) > 0 ? 2 * precision * recall / (precision + recall) : 0;
+    if (quantize == "int8" || quantize == "fp16") {
+        trace::ScopedTimer timer("quantized_evaluation");
+        Precision precision = quantize == "int8" ? Precision::Int8 : Precision::Float16;
+        const EmbeddingTable& embeddings = dh.get_embeddings(INPUT_SIZE);
+        QuantizedEmbeddingTable q_embeddings(embeddings, precision);
+        QuantizedNetwork q_nn(nn, precision);
+
+        std::vector<float> q_matrix, q_labels;
+        FeaturePipeline(q_embeddings, selected_features).transform(dh.get_test_data(), q_matrix, q_labels);
+        std::vector<float> predictions(q_labels.size());
+        q_nn.predict_batch(q_matrix.data(), q_labels.size(), predictions.data(), 0);
+        size_t correct = 0;
+        for (size_t i = 0; i < predictions.size(); ++i) {
+            if ((predictions[i] > 0.5f ? 1.0f : 0.0f) == q_labels[i]) correct++;
+        }
+        std::cout << "\nQuantized (" << quantize << ") test accuracy: " << (100.0 * correct / predictions.size()) << "%" << std::endl;
+        std::cout << "Embedding table: " << q_embeddings.memory_bytes() / 1024 << " KB (float: "
+            << embeddings.get_rows() * embeddings.get_dim() * sizeof(float) / 1024 << " KB)" << std::endl;
+    }
 
-    std::cout << "Precision: " << precision << std::endl;
-    std::cout << "Recall: " << recall << std::endl;
-    std::cout << "F1 Score: " << f1 << std::endl;
+    if (!trace_file.empty()) trace::write_chrome_trace(trace_file);
+    if (!metrics_file.empty()) trace::write_metrics(metrics_file);
     return 0;
 }
\ No newline at end of file
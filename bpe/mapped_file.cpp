@@ -0,0 +1,97 @@
+#include "mapped_file.h"
+#include <iostream>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace bpe {
+
+MappedFile::MappedFile() {}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& filename) {
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        std::cerr << "Error: Cannot open file: " << filename << std::endl;
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    file_handle = file;
+    if (file_size.QuadPart == 0) {
+        std::cerr << "Error: Empty file: " << filename << std::endl;
+        close();
+        return false;
+    }
+    HANDLE map = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* view = map ? MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    map_handle = map;
+    if (!view) {
+        std::cerr << "Error: Cannot map file: " << filename << std::endl;
+        close();
+        return false;
+    }
+    mapping = view;
+    mapping_size = static_cast<size_t>(file_size.QuadPart);
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error: Cannot open file: " << filename << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        std::cerr << "Error: Empty file: " << filename << std::endl;
+        return false;
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (view == MAP_FAILED) {
+        std::cerr << "Error: Cannot map file: " << filename << std::endl;
+        return false;
+    }
+    mapping = view;
+    mapping_size = static_cast<size_t>(st.st_size);
+#endif
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (mapping) UnmapViewOfFile(mapping);
+    if (map_handle) CloseHandle(map_handle);
+    if (file_handle) CloseHandle(file_handle);
+    map_handle = nullptr;
+    file_handle = nullptr;
+#else
+    if (mapping) munmap(mapping, mapping_size);
+#endif
+    mapping = nullptr;
+    mapping_size = 0;
+}
+
+bool MappedFile::is_open() const {
+    return mapping != nullptr;
+}
+
+const char* MappedFile::data() const {
+    return static_cast<const char*>(mapping);
+}
+
+size_t MappedFile::size() const {
+    return mapping_size;
+}
+
+}
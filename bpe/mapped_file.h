@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+namespace bpe {
+
+/// <summary>
+/// Read only memory mapping of a whole file (mmap on POSIX, a file mapping on Windows).
+/// The data stays valid until close() or destruction.
+/// </summary>
+class MappedFile {
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* map_handle = nullptr;
+#endif
+
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /// <summary>
+    /// Maps filename. Fails (and prints why) for missing or empty files.
+    /// </summary>
+    bool open(const std::string& filename);
+    void close();
+    bool is_open() const;
+
+    const char* data() const;
+    size_t size() const;
+};
+
+}
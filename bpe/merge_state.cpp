@@ -0,0 +1,122 @@
+#include "merge_state.h"
+#include <algorithm>
+#include <cassert>
+
+namespace bpe {
+
+MergeState::MergeState(Uint32Array tokens) : tok(std::move(tokens)) {
+    const uint32_t NONE = UINT32_MAX;
+    assert(tok.size() < NONE);
+    const uint32_t n = static_cast<uint32_t>(tok.size());
+    prev.resize(n);
+    next.resize(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        prev[i] = (i == 0) ? NONE : i - 1;
+        next[i] = (i + 1 == n) ? NONE : i + 1;
+    }
+    for (uint32_t i = 0; i + 1 < n; ++i) {
+        if (tok[i] == SEPARATOR || tok[i + 1] == SEPARATOR) continue;
+        positions[Pair{ tok[i], tok[i + 1] }].push_back(i);
+    }
+    live = n;
+}
+
+std::vector<PairDelta> MergeState::initial_counts() const {
+    std::vector<PairDelta> counts;
+    counts.reserve(positions.size());
+    positions.for_each([&](const Pair& p, const std::vector<uint32_t>& sites) {
+        counts.push_back({ p, static_cast<int64_t>(sites.size()) });
+    });
+    return counts;
+}
+
+void MergeState::add(const Pair& p, uint32_t pos) {
+    positions[p].push_back(pos);
+    changes.push_back({ p, 1 });
+}
+
+void MergeState::remove(const Pair& p) {
+    changes.push_back({ p, -1 });
+}
+
+const std::vector<PairDelta>& MergeState::merge(const Pair& pair, uint32_t new_token) {
+    const uint32_t NONE = UINT32_MAX;
+    changes.clear();
+    std::vector<uint32_t>* found = positions.find(pair);
+    if (!found) return changes;
+
+    // replace left to right, which matters for runs like "aaa"
+    std::vector<uint32_t> sites = std::move(*found);
+    positions.erase(pair);
+    std::sort(sites.begin(), sites.end());
+    for (uint32_t i : sites) {
+        if (tok[i] != pair.l) continue;
+        uint32_t j = next[i];
+        if (j == NONE || tok[j] != pair.r) continue;
+        uint32_t before = prev[i];
+        uint32_t after = next[j];
+
+        if (before != NONE && tok[before] != SEPARATOR) {
+            remove(Pair{ tok[before], pair.l });
+            add(Pair{ tok[before], new_token }, before);
+        }
+        remove(pair);
+        if (after != NONE && tok[after] != SEPARATOR) {
+            remove(Pair{ pair.r, tok[after] });
+            add(Pair{ new_token, tok[after] }, i);
+        }
+
+        tok[i] = new_token;
+        // a removed node can never match again because its token is gone from the list
+        tok[j] = SEPARATOR;
+        next[i] = after;
+        if (after != NONE) prev[after] = i;
+        live--;
+    }
+    return changes;
+}
+
+size_t MergeState::live_tokens() const {
+    return live;
+}
+
+Uint32Array MergeState::tokens() const {
+    const uint32_t NONE = UINT32_MAX;
+    Uint32Array result;
+    result.reserve(live);
+    for (uint32_t i = tok.empty() ? NONE : 0; i != NONE; i = next[i]) {
+        result.push_back(tok[i]);
+    }
+    return result;
+}
+
+bool MergeQueue::Entry::operator<(const Entry& other) const {
+    if (count != other.count) return count < other.count;
+    return other.pair < pair;
+}
+
+void MergeQueue::add(const Pair& p, int64_t delta) {
+    size_t& c = counts[p];
+    c = static_cast<size_t>(static_cast<int64_t>(c) + delta);
+    if (c > 1) heap.push({ c, p });
+    else if (c == 0) counts.erase(p);
+}
+
+void MergeQueue::add(const std::vector<PairDelta>& deltas) {
+    for (const auto& d : deltas) add(d.pair, d.delta);
+}
+
+bool MergeQueue::pop_best(Pair& best, size_t& count) {
+    while (!heap.empty()) {
+        Entry top = heap.top();
+        heap.pop();
+        const size_t* found = counts.find(top.pair);
+        if (!found || *found != top.count) continue; // stale
+        best = top.pair;
+        count = top.count;
+        return true;
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <cstdint>
+#include "bpe.h"
+#include "pair_map.h"
+
+namespace bpe {
+
+// tokens with this value split a stream into documents, pairs never span it
+const uint32_t SEPARATOR = UINT32_MAX;
+
+struct PairDelta {
+    Pair pair;
+    int64_t delta;
+};
+
+/// <summary>
+/// Token stream of the incremental trainer. Tokens live in a doubly linked list over their
+/// original positions, so a merged token keeps the position of its left half and position order
+/// is always sequence order. Every pair keeps a list of positions where it was created; stale
+/// positions are skipped when the pair is merged. Pair counts are not kept here, every merge
+/// reports the count changes it caused so the owner (or a coordinator) can track them.
+/// </summary>
+class MergeState {
+    Uint32Array tok;
+    std::vector<uint32_t> prev, next;
+    PairMap<std::vector<uint32_t>> positions;
+    std::vector<PairDelta> changes;
+    size_t live = 0;
+
+    void add(const Pair& p, uint32_t pos);
+    void remove(const Pair& p);
+
+public:
+    explicit MergeState(Uint32Array tokens);
+
+    /// <summary>
+    /// Count of every adjacent pair in the stream, as found by the constructor.
+    /// </summary>
+    std::vector<PairDelta> initial_counts() const;
+
+    /// <summary>
+    /// Replaces every occurrence of pair, left to right, with new_token and returns the +1/-1
+    /// count changes that caused. The returned vector is reused by the next call.
+    /// </summary>
+    const std::vector<PairDelta>& merge(const Pair& pair, uint32_t new_token);
+
+    size_t live_tokens() const;
+    Uint32Array tokens() const;
+};
+
+/// <summary>
+/// Live pair counts plus a max-heap of (count, pair) snapshots. Heap entries whose count no
+/// longer matches the live count are dropped when they reach the top. Ties go to the smallest
+/// pair so the choice never depends on hash order.
+/// </summary>
+class MergeQueue {
+    struct Entry {
+        size_t count;
+        Pair pair;
+        bool operator<(const Entry& other) const;
+    };
+    PairMap<size_t> counts;
+    std::priority_queue<Entry> heap;
+
+public:
+    void add(const Pair& p, int64_t delta);
+    void add(const std::vector<PairDelta>& deltas);
+
+    /// <summary>
+    /// Takes the most frequent pair off the queue. Returns false once no pair occurs more than once.
+    /// </summary>
+    bool pop_best(Pair& best, size_t& count);
+};
+
+}
@@ -0,0 +1,170 @@
+#include "model.h"
+#include "binary_vocab.h"
+#include "parallel.h"
+#include "trace.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+static const size_t SECTION_ALIGNMENT = 64;
+
+// Pads buffer with zeros up to the next section boundary and returns that offset
+static uint64_t align_section(std::string& buffer) {
+    size_t padded = (buffer.size() + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+    buffer.resize(padded, '\0');
+    return padded;
+}
+
+Model::Model() {}
+
+Model::~Model() {}
+
+bool Model::save(const std::string& filename, const bpe::Tokenizer& tokenizer, const EmbeddingTable& embeddings,
+    const std::vector<uint32_t>& selected_features, const NeuralNetwork& network) {
+    trace::ScopedTimer timer("model.save", "model");
+    std::string vocab;
+    if (!bpe::serialize_binary_vocab(tokenizer.get_pairs(), vocab)) return false;
+    if (embeddings.get_dim() != network.get_input_size()) {
+        std::cerr << "\nError writing model: embedding size " << embeddings.get_dim()
+            << " does not match network input size " << network.get_input_size() << std::endl;
+        return false;
+    }
+    const std::vector<float> weights = network.get_weights();
+
+    ModelHeader header{};
+    header.magic = MODEL_MAGIC;
+    header.version = MODEL_VERSION;
+    header.embedding_rows = static_cast<uint32_t>(embeddings.get_rows());
+    header.embedding_dim = static_cast<uint32_t>(embeddings.get_dim());
+    header.feature_count = static_cast<uint32_t>(selected_features.size());
+    header.weight_count = static_cast<uint32_t>(weights.size());
+
+    // lay the sections out after a placeholder header, then fill the header in
+    std::string buffer(sizeof(ModelHeader), '\0');
+    header.vocab_offset = align_section(buffer);
+    header.vocab_size = vocab.size();
+    buffer += vocab;
+    header.embedding_offset = align_section(buffer);
+    buffer.append(reinterpret_cast<const char*>(embeddings.get_data()), embeddings.get_rows() * embeddings.get_stride() * sizeof(float));
+    header.feature_offset = align_section(buffer);
+    buffer.append(reinterpret_cast<const char*>(selected_features.data()), selected_features.size() * sizeof(uint32_t));
+    header.weight_offset = align_section(buffer);
+    buffer.append(reinterpret_cast<const char*>(weights.data()), weights.size() * sizeof(float));
+    header.file_size = buffer.size();
+    header.checksum = bpe::fnv1a_64(buffer.data() + sizeof(ModelHeader), buffer.size() - sizeof(ModelHeader));
+    std::memcpy(&buffer[0], &header, sizeof(header));
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        std::cerr << "\nError writing model: " << filename << std::endl;
+        return false;
+    }
+    out.write(buffer.data(), buffer.size());
+    return static_cast<bool>(out);
+}
+
+bool Model::load(const std::string& filename, bool verify_checksum) {
+    trace::ScopedTimer timer("model.load", "model");
+    close();
+    if (!file.open(filename)) return false;
+
+    // validate the header and every section range before trusting any pointer into the file
+    const char* base = file.data();
+    const size_t size = file.size();
+    const ModelHeader* h = reinterpret_cast<const ModelHeader*>(base);
+    bool valid = size >= sizeof(ModelHeader) && h->magic == MODEL_MAGIC && h->version == MODEL_VERSION && h->file_size == size;
+    auto in_file = [&](uint64_t offset, uint64_t bytes) {
+        return offset % SECTION_ALIGNMENT == 0 && offset >= sizeof(ModelHeader) && offset <= size && bytes <= size - offset;
+    };
+    if (valid) {
+        const uint64_t embedding_bytes = uint64_t(h->embedding_rows) * EmbeddingTable::stride_for(h->embedding_dim) * sizeof(float);
+        valid = in_file(h->vocab_offset, h->vocab_size)
+            && in_file(h->embedding_offset, embedding_bytes)
+            && in_file(h->feature_offset, uint64_t(h->feature_count) * sizeof(uint32_t))
+            && in_file(h->weight_offset, uint64_t(h->weight_count) * sizeof(float))
+            && h->weight_count == 2 * uint64_t(h->embedding_dim) + 5;
+    }
+    if (valid && verify_checksum) {
+        valid = bpe::fnv1a_64(base + sizeof(ModelHeader), size - sizeof(ModelHeader)) == h->checksum;
+    }
+    const bpe::VocabHeader* vocab = valid ? bpe::check_binary_vocab(base + h->vocab_offset, h->vocab_size, false) : nullptr;
+    // every vocabulary token and every selected feature indexes an embedding row
+    valid = vocab && h->embedding_rows >= vocab->pair_count;
+    if (valid) {
+        const uint32_t* features = reinterpret_cast<const uint32_t*>(base + h->feature_offset);
+        valid = std::all_of(features, features + h->feature_count, [&](uint32_t feature) { return feature < h->embedding_rows; });
+    }
+    if (!valid) {
+        std::cerr << "Error: Corrupt or unsupported model: " << filename << std::endl;
+        close();
+        return false;
+    }
+
+    // the tokenizer decodes straight from the vocabulary section of the mapping
+    auto mapped_vocab = std::make_shared<bpe::MappedVocab>();
+    mapped_vocab->attach(base + h->vocab_offset, h->vocab_size, false);
+    tokenizer.set_vocab(std::move(mapped_vocab));
+    embeddings.attach(reinterpret_cast<const float*>(base + h->embedding_offset), h->embedding_rows, h->embedding_dim);
+    const uint32_t* features = reinterpret_cast<const uint32_t*>(base + h->feature_offset);
+    selected_features.assign(features, features + h->feature_count);
+    const float* weights = reinterpret_cast<const float*>(base + h->weight_offset);
+    network.reset(new NeuralNetwork(h->embedding_dim, 0));
+    network->set_weights(std::vector<float>(weights, weights + h->weight_count));
+    pipeline.reset(new FeaturePipeline(embeddings, selected_features));
+    return true;
+}
+
+void Model::close() {
+    pipeline.reset();
+    network.reset();
+    selected_features.clear();
+    embeddings.attach(nullptr, 0, 0);
+    tokenizer.set_pairs(bpe::PairArray());
+    file.close();
+}
+
+bool Model::is_loaded() const {
+    return pipeline != nullptr;
+}
+
+float Model::score(const std::string& text) const {
+    thread_local bpe::Uint32Array tokens;
+    thread_local std::vector<float> features;
+    tokenizer.encode(text, tokens);
+    features.resize(pipeline->get_output_size());
+    pipeline->transform(tokens, features.data());
+    return network->predict(features.data());
+}
+
+void Model::score_batch(const std::vector<std::string>& texts, float* out, size_t threads) const {
+    // featurize every message into one row-major matrix, then predict it in a single pass
+    const size_t width = pipeline->get_output_size();
+    std::vector<float> matrix(texts.size() * width);
+    bpe::parallel_for(texts.size(), threads, 16, [&](size_t i) {
+        thread_local bpe::Uint32Array tokens;
+        tokenizer.encode(texts[i], tokens);
+        pipeline->transform(tokens, matrix.data() + i * width);
+    });
+    network->predict_batch(matrix.data(), texts.size(), out, threads);
+}
+
+const bpe::Tokenizer& Model::get_tokenizer() const {
+    return tokenizer;
+}
+
+const EmbeddingTable& Model::get_embeddings() const {
+    return embeddings;
+}
+
+const std::vector<uint32_t>& Model::get_selected_features() const {
+    return selected_features;
+}
+
+const NeuralNetwork& Model::get_network() const {
+    return *network;
+}
+
+const FeaturePipeline& Model::get_pipeline() const {
+    return *pipeline;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "tokenizer.h"
+#include "embedding_table.h"
+#include "feature_pipeline.h"
+#include "mapped_file.h"
+#include "nn.h"
+
+// Model file, little endian. Every section starts on a 64 byte boundary so the file can be
+// used straight from an mmap:
+//   ModelHeader
+//   vocab       a complete binary vocab (see binary_vocab.h), vocab_size bytes
+//   embeddings  embedding_rows rows of EmbeddingTable::stride_for(embedding_dim) floats
+//   features    uint32_t selected_features[feature_count]
+//   weights     float weights[weight_count] in NeuralNetwork::get_weights order
+// The checksum is FNV-1a 64 over everything after the header.
+const uint32_t MODEL_MAGIC = 0x4d455042; // "BPEM"
+const uint32_t MODEL_VERSION = 1;
+
+struct ModelHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t embedding_rows;
+    uint32_t embedding_dim;
+    uint32_t feature_count;
+    uint32_t weight_count;
+    uint64_t vocab_offset;
+    uint64_t vocab_size;
+    uint64_t embedding_offset;
+    uint64_t feature_offset;
+    uint64_t weight_offset;
+    uint64_t file_size;
+    uint64_t checksum;
+};
+
+/// <summary>
+/// Everything needed to classify a message, stored in and loaded from one file: the BPE vocabulary,
+/// the embedding table, the selected features and the network weights. A loaded model maps the file
+/// and uses the embedding rows in place, so loading costs milliseconds rather than a retrain.
+/// Scoring is const and safe to call from several threads.
+/// </summary>
+class Model {
+    bpe::MappedFile file;
+    bpe::Tokenizer tokenizer;
+    EmbeddingTable embeddings;
+    std::vector<uint32_t> selected_features;
+    std::unique_ptr<NeuralNetwork> network;
+    std::unique_ptr<FeaturePipeline> pipeline;
+
+public:
+    Model();
+    ~Model();
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+
+    static bool save(const std::string& filename, const bpe::Tokenizer& tokenizer, const EmbeddingTable& embeddings,
+        const std::vector<uint32_t>& selected_features, const NeuralNetwork& network);
+
+    /// <summary>
+    /// Maps and validates filename. On failure prints why and leaves the model empty.
+    /// </summary>
+    bool load(const std::string& filename, bool verify_checksum = true);
+    void close();
+    bool is_loaded() const;
+
+    /// <summary>
+    /// Spam probability of a raw message: tokenize, filter + embed, predict.
+    /// </summary>
+    float score(const std::string& text) const;
+
+    /// <summary>
+    /// Scores texts into out (one float each): every message is featurized into one matrix, which
+    /// NeuralNetwork::predict_batch then scores in a single call.
+    /// </summary>
+    void score_batch(const std::vector<std::string>& texts, float* out, size_t threads = 1) const;
+
+    const bpe::Tokenizer& get_tokenizer() const;
+    const EmbeddingTable& get_embeddings() const;
+    const std::vector<uint32_t>& get_selected_features() const;
+    const NeuralNetwork& get_network() const;
+    const FeaturePipeline& get_pipeline() const;
+};
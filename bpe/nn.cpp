@@ -1,7 +1,16 @@
 #include "nn.h"
+#include "parallel.h"
+#include "trace.h"
+#include <algorithm>
+#include <numeric>
 #include <random>
 #include <cmath>
 #include <iostream>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
 NeuralNetwork::NeuralNetwork(size_t input_size, size_t iterations)
 	: input_size(input_size), iterations(iterations) {
@@ -83,7 +92,280 @@ float NeuralNetwork::train(const std::vector<std::vector<float>>& X, const std::
 	return 0.0f;
 }
 
-float NeuralNetwork::predict(const std::vector<float>& x) {
-	return forward(x);
+float NeuralNetwork::predict(const std::vector<float>& x) const {
+	return infer(x.data());
 }
 
+float NeuralNetwork::predict(const float* x) const {
+	return infer(x);
+}
+
+void NeuralNetwork::predict_batch(const float* X, size_t rows, float* out, size_t threads) const {
+	bpe::parallel_for(rows, threads, 256, [&](size_t i) {
+		out[i] = infer(X + i * input_size);
+	});
+}
+
+size_t NeuralNetwork::get_input_size() const {
+	return input_size;
+}
+
+// da = x . a and db = x . b in one pass over x
+static inline void dot2(const float* x, const float* a, const float* b, size_t n, float& da, float& db) {
+	size_t i = 0;
+	da = 0.0f;
+	db = 0.0f;
+#if defined(__AVX2__)
+	__m256 sa = _mm256_setzero_ps(), sb = _mm256_setzero_ps();
+	for (; i + 8 <= n; i += 8) {
+		__m256 xv = _mm256_loadu_ps(x + i);
+		sa = _mm256_add_ps(sa, _mm256_mul_ps(xv, _mm256_loadu_ps(a + i)));
+		sb = _mm256_add_ps(sb, _mm256_mul_ps(xv, _mm256_loadu_ps(b + i)));
+	}
+	float ta[8], tb[8];
+	_mm256_storeu_ps(ta, sa);
+	_mm256_storeu_ps(tb, sb);
+	for (int k = 0; k < 8; ++k) {
+		da += ta[k];
+		db += tb[k];
+	}
+#elif defined(__SSE2__) || defined(_M_X64)
+	__m128 sa = _mm_setzero_ps(), sb = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4) {
+		__m128 xv = _mm_loadu_ps(x + i);
+		sa = _mm_add_ps(sa, _mm_mul_ps(xv, _mm_loadu_ps(a + i)));
+		sb = _mm_add_ps(sb, _mm_mul_ps(xv, _mm_loadu_ps(b + i)));
+	}
+	float ta[4], tb[4];
+	_mm_storeu_ps(ta, sa);
+	_mm_storeu_ps(tb, sb);
+	for (int k = 0; k < 4; ++k) {
+		da += ta[k];
+		db += tb[k];
+	}
+#endif
+	for (; i < n; ++i) {
+		da += x[i] * a[i];
+		db += x[i] * b[i];
+	}
+}
+
+// ga += sa * x and gb += sb * x
+static inline void axpy2(const float* x, float sa, float sb, float* ga, float* gb, size_t n) {
+	size_t i = 0;
+#if defined(__AVX2__)
+	__m256 va = _mm256_set1_ps(sa), vb = _mm256_set1_ps(sb);
+	for (; i + 8 <= n; i += 8) {
+		__m256 xv = _mm256_loadu_ps(x + i);
+		_mm256_storeu_ps(ga + i, _mm256_add_ps(_mm256_loadu_ps(ga + i), _mm256_mul_ps(va, xv)));
+		_mm256_storeu_ps(gb + i, _mm256_add_ps(_mm256_loadu_ps(gb + i), _mm256_mul_ps(vb, xv)));
+	}
+#elif defined(__SSE2__) || defined(_M_X64)
+	__m128 va = _mm_set1_ps(sa), vb = _mm_set1_ps(sb);
+	for (; i + 4 <= n; i += 4) {
+		__m128 xv = _mm_loadu_ps(x + i);
+		_mm_storeu_ps(ga + i, _mm_add_ps(_mm_loadu_ps(ga + i), _mm_mul_ps(va, xv)));
+		_mm_storeu_ps(gb + i, _mm_add_ps(_mm_loadu_ps(gb + i), _mm_mul_ps(vb, xv)));
+	}
+#endif
+	for (; i < n; ++i) {
+		ga[i] += sa * x[i];
+		gb[i] += sb * x[i];
+	}
+}
+
+// Summed gradients (and weighted loss) of one worker's share of a batch
+struct NeuralNetwork::Gradients {
+	std::vector<float> w_hidden_1, w_hidden_2;
+	float b_hidden_1, b_hidden_2, w_h_output_1, w_h_output_2, b_output;
+	double loss;
+
+	explicit Gradients(size_t input_size) : w_hidden_1(input_size), w_hidden_2(input_size) {
+		clear();
+	}
+	void clear() {
+		std::fill(w_hidden_1.begin(), w_hidden_1.end(), 0.0f);
+		std::fill(w_hidden_2.begin(), w_hidden_2.end(), 0.0f);
+		b_hidden_1 = b_hidden_2 = w_h_output_1 = w_h_output_2 = b_output = 0.0f;
+		loss = 0.0;
+	}
+};
+
+// Same math as forward() + backward(), but reads the weights only and adds the gradients of
+// rows order[begin..end) into g. The class weight multiplies each sample's gradient.
+void NeuralNetwork::accumulate_gradients(const float* X, const float* y, const uint32_t* order, size_t begin, size_t end, const TrainConfig& config, Gradients& g) const {
+	for (size_t r = begin; r < end; ++r) {
+		const float* x = X + static_cast<size_t>(order[r]) * input_size;
+		const float y_true = y[order[r]];
+		const float class_weight = (y_true == 1.0f) ? config.weight_spam : config.weight_ham;
+
+		float h1_in, h2_in;
+		dot2(x, w_hidden_1.data(), w_hidden_2.data(), input_size, h1_in, h2_in);
+		h1_in += b_hidden_1;
+		h2_in += b_hidden_2;
+		const float h1_out = 1.f / (1.f + std::exp(-h1_in));
+		const float h2_out = 1.f / (1.f + std::exp(-h2_in));
+		const float out_in = h1_out * w_h_output_1 + h2_out * w_h_output_2 + b_output;
+		const float pred = 1.f / (1.f + std::exp(-out_in));
+
+		const float err = pred - y_true;
+		g.loss += class_weight * err * err;
+
+		// sigmoid'(z) = s(z) * (1 - s(z)), and s(z) is already known for every layer
+		const float d_out = class_weight * 2 * err * pred * (1 - pred);
+		const float d_h1 = d_out * w_h_output_1 * h1_out * (1 - h1_out);
+		const float d_h2 = d_out * w_h_output_2 * h2_out * (1 - h2_out);
+
+		g.w_h_output_1 += d_out * h1_out;
+		g.w_h_output_2 += d_out * h2_out;
+		g.b_output += d_out;
+		g.b_hidden_1 += d_h1;
+		g.b_hidden_2 += d_h2;
+		axpy2(x, d_h1, d_h2, g.w_hidden_1.data(), g.w_hidden_2.data(), input_size);
+	}
+}
+
+// Sums every worker's gradients and takes one step of the batch-mean gradient
+void NeuralNetwork::apply_gradients(const std::vector<Gradients>& grads, size_t rows, float learning_rate) {
+	const float step = learning_rate / static_cast<float>(rows);
+	for (const auto& g : grads) {
+		for (size_t i = 0; i < input_size; ++i) {
+			w_hidden_1[i] -= step * g.w_hidden_1[i];
+			w_hidden_2[i] -= step * g.w_hidden_2[i];
+		}
+		b_hidden_1 -= step * g.b_hidden_1;
+		b_hidden_2 -= step * g.b_hidden_2;
+		w_h_output_1 -= step * g.w_h_output_1;
+		w_h_output_2 -= step * g.w_h_output_2;
+		b_output -= step * g.b_output;
+	}
+}
+
+// Forward pass that only reads the weights
+float NeuralNetwork::infer(const float* x) const {
+	float h1_in, h2_in;
+	dot2(x, w_hidden_1.data(), w_hidden_2.data(), input_size, h1_in, h2_in);
+	const float h1_out = 1.f / (1.f + std::exp(-(h1_in + b_hidden_1)));
+	const float h2_out = 1.f / (1.f + std::exp(-(h2_in + b_hidden_2)));
+	return 1.f / (1.f + std::exp(-(h1_out * w_h_output_1 + h2_out * w_h_output_2 + b_output)));
+}
+
+float NeuralNetwork::evaluate_loss(const float* X, const float* y, size_t rows, float weight_ham, float weight_spam) const {
+	double loss = 0.0;
+	for (size_t i = 0; i < rows; ++i) {
+		const float err = infer(X + i * input_size) - y[i];
+		loss += ((y[i] == 1.0f) ? weight_spam : weight_ham) * err * err;
+	}
+	return rows > 0 ? static_cast<float>(loss / rows) : 0.0f;
+}
+
+std::vector<float> NeuralNetwork::get_weights() const {
+	std::vector<float> weights(w_hidden_1);
+	weights.insert(weights.end(), w_hidden_2.begin(), w_hidden_2.end());
+	weights.insert(weights.end(), { b_hidden_1, b_hidden_2, w_h_output_1, w_h_output_2, b_output });
+	return weights;
+}
+
+void NeuralNetwork::set_weights(const std::vector<float>& weights) {
+	const float* p = weights.data();
+	std::copy(p, p + input_size, w_hidden_1.begin());
+	std::copy(p + input_size, p + 2 * input_size, w_hidden_2.begin());
+	p += 2 * input_size;
+	b_hidden_1 = p[0];
+	b_hidden_2 = p[1];
+	w_h_output_1 = p[2];
+	w_h_output_2 = p[3];
+	b_output = p[4];
+}
+
+float NeuralNetwork::train_minibatch(const float* X, const float* y, size_t rows, const TrainConfig& config) {
+	TrainHistory history = train_scheduled(X, y, rows, nullptr, nullptr, 0, config);
+	return history.train_loss.empty() ? 0.0f : history.train_loss.back();
+}
+
+float NeuralNetwork::train_minibatch(const std::vector<float>& X, const std::vector<float>& y, const TrainConfig& config) {
+	return train_minibatch(X.data(), y.data(), y.size(), config);
+}
+
+TrainHistory NeuralNetwork::train_scheduled(const float* X, const float* y, size_t rows,
+	const float* X_val, const float* y_val, size_t val_rows, const TrainConfig& config) {
+	trace::ScopedTimer timer("nn.train_minibatch", "nn");
+	const size_t epochs = config.epochs ? config.epochs : iterations;
+	const size_t batch = std::max<size_t>(1, config.batch_size);
+	const size_t workers = std::max<size_t>(1, std::min(bpe::resolve_thread_count(config.threads), batch / MIN_ROWS_PER_WORKER));
+	const size_t eval_every = std::max<size_t>(1, config.eval_every);
+	const bool validate = val_rows > 0;
+
+	std::vector<uint32_t> order(rows);
+	std::iota(order.begin(), order.end(), 0);
+	std::mt19937 gen(config.seed);
+	std::vector<Gradients> grads(workers, Gradients(input_size));
+	bpe::Barrier barrier(workers);
+	double epoch_loss = 0.0;
+	float learning_rate = config.learning_rate;
+	size_t checks_without_improvement = 0;
+	std::vector<float> best_weights;
+	bool stop = false;
+
+	TrainHistory history;
+	history.train_loss.reserve(epochs);
+
+	// called by worker 0 alone after each epoch; records losses and decides whether to stop
+	auto end_epoch = [&](size_t epoch) {
+		history.train_loss.push_back(rows > 0 ? static_cast<float>(epoch_loss / rows) : 0.0f);
+		history.epochs_run = epoch + 1;
+		if (!validate || (epoch + 1) % eval_every != 0) return;
+
+		float val_loss = evaluate_loss(X_val, y_val, val_rows, config.weight_ham, config.weight_spam);
+		history.validation_loss.push_back(val_loss);
+		history.validation_epochs.push_back(epoch + 1);
+		if (history.validation_loss.size() == 1 || val_loss < history.best_validation_loss - config.min_delta) {
+			history.best_validation_loss = val_loss;
+			history.best_epoch = epoch + 1;
+			checks_without_improvement = 0;
+			if (config.restore_best) best_weights = get_weights();
+			return;
+		}
+		learning_rate *= config.lr_decay;
+		if (config.patience > 0 && ++checks_without_improvement >= config.patience) {
+			history.stopped_early = true;
+			stop = true;
+		}
+	};
+
+	// every worker walks the same batches in lockstep: compute its slice, wait, worker 0 applies
+	// the summed update, wait again so nobody reads weights mid-update
+	bpe::parallel_chunks(workers, [&](size_t w) {
+		for (size_t epoch = 0; epoch < epochs; ++epoch) {
+			if (w == 0) {
+				std::shuffle(order.begin(), order.end(), gen);
+				epoch_loss = 0.0;
+			}
+			barrier.wait();
+			for (size_t start = 0; start < rows; start += batch) {
+				const size_t n = std::min(batch, rows - start);
+				grads[w].clear();
+				accumulate_gradients(X, y, order.data(), start + n * w / workers, start + n * (w + 1) / workers, config, grads[w]);
+				barrier.wait();
+				if (w == 0) {
+					apply_gradients(grads, n, learning_rate);
+					for (const auto& g : grads) epoch_loss += g.loss;
+				}
+				barrier.wait();
+			}
+			if (w == 0) end_epoch(epoch);
+			barrier.wait();
+			if (stop) break;
+		}
+	});
+
+	if (!best_weights.empty()) set_weights(best_weights);
+	history.final_learning_rate = learning_rate;
+	trace::counter("nn.epochs", static_cast<double>(history.epochs_run));
+	return history;
+}
+
+TrainHistory NeuralNetwork::train_scheduled(const std::vector<float>& X, const std::vector<float>& y,
+	const std::vector<float>& X_val, const std::vector<float>& y_val, const TrainConfig& config) {
+	return train_scheduled(X.data(), y.data(), y.size(), X_val.data(), y_val.data(), y_val.size(), config);
+}
@@ -1,13 +1,101 @@
 #pragma once
 #include <vector>
 #include <cstddef>
+#include <cstdint>
+
+/// <summary>
+/// Settings for NeuralNetwork::train_minibatch. Class weights scale each sample's gradient the same
+/// way train() scales its learning rate.
+/// </summary>
+struct TrainConfig {
+    size_t epochs = 0;          // 0 uses the iterations given to the constructor
+    size_t batch_size = 32;
+    float learning_rate = 0.1f;
+    float weight_ham = 1.0f;
+    float weight_spam = 1.0f;
+    size_t threads = 1;         // 0 = one per hardware thread, capped so each gets MIN_ROWS_PER_WORKER rows of a batch
+    unsigned seed = 42;         // order the rows are shuffled in each epoch
+
+    // used by train_scheduled when a validation set is given
+    size_t eval_every = 1;      // epochs between validation checks
+    size_t patience = 0;        // checks without improvement before stopping, 0 = run every epoch
+    float min_delta = 1e-4f;    // validation loss must drop by more than this to count as improvement
+    float lr_decay = 1.0f;      // learning rate multiplier after each check without improvement, 1 = off
+    bool restore_best = true;   // keep the weights from the best check rather than the last epoch
+};
+
+/// <summary>
+/// What happened during NeuralNetwork::train_scheduled, one train_loss per epoch run and one
+/// validation_loss per check.
+/// </summary>
+struct TrainHistory {
+    std::vector<float> train_loss;
+    std::vector<float> validation_loss;
+    std::vector<size_t> validation_epochs; // 1-based epoch each validation_loss was measured after
+    size_t epochs_run = 0;
+    size_t best_epoch = 0;
+    float best_validation_loss = 0.0f;
+    float final_learning_rate = 0.0f;
+    bool stopped_early = false;
+};
 
 class NeuralNetwork {
 public:
+    static const size_t MIN_ROWS_PER_WORKER = 64;
+
     NeuralNetwork(size_t input_size, size_t iterations);
     float train(const std::vector<std::vector<float>>& X, const std::vector<float>& y, float magnitude, float weight_ham, float weight_spam);
-    float predict(const std::vector<float>& x);
+
+    /// <summary>
+    /// Mini-batch gradient descent over a row-major rows x input_size matrix X with labels y.
+    /// Each batch's gradient is split across threads and summed before one update.
+    /// Returns the weighted mean squared error of the last epoch.
+    /// </summary>
+    float train_minibatch(const float* X, const float* y, size_t rows, const TrainConfig& config);
+    float train_minibatch(const std::vector<float>& X, const std::vector<float>& y, const TrainConfig& config);
+
+    /// <summary>
+    /// train_minibatch plus a schedule driven by a validation set: every eval_every epochs the weighted
+    /// loss on X_val is checked; after patience checks without improvement training stops, and each
+    /// check without improvement multiplies the learning rate by lr_decay. Runs at most config.epochs
+    /// epochs. With no validation rows it behaves like train_minibatch.
+    /// </summary>
+    TrainHistory train_scheduled(const float* X, const float* y, size_t rows,
+        const float* X_val, const float* y_val, size_t val_rows, const TrainConfig& config);
+    TrainHistory train_scheduled(const std::vector<float>& X, const std::vector<float>& y,
+        const std::vector<float>& X_val, const std::vector<float>& y_val, const TrainConfig& config);
+
+    /// <summary>
+    /// Class-weighted mean squared error over a row-major rows x input_size matrix.
+    /// </summary>
+    float evaluate_loss(const float* X, const float* y, size_t rows, float weight_ham, float weight_spam) const;
+
+    /// <summary>
+    /// Spam probability of one feature row. Reads the weights only, so one trained model can be
+    /// shared by any number of scoring threads.
+    /// </summary>
+    float predict(const std::vector<float>& x) const;
+    float predict(const float* x) const;
+
+    /// <summary>
+    /// Scores a row-major rows x input_size matrix into out (rows floats), split across threads
+    /// (0 = one per hardware thread).
+    /// </summary>
+    void predict_batch(const float* X, size_t rows, float* out, size_t threads = 1) const;
+
+    size_t get_input_size() const;
+
+    /// <summary>
+    /// All weights flattened as w_hidden_1, w_hidden_2, b_hidden_1, b_hidden_2, w_h_output_1, w_h_output_2, b_output.
+    /// </summary>
+    std::vector<float> get_weights() const;
+    void set_weights(const std::vector<float>& weights);
 private:
+    struct Gradients;
+    void accumulate_gradients(const float* X, const float* y, const uint32_t* order, size_t begin, size_t end, const TrainConfig& config, Gradients& g) const;
+    void apply_gradients(const std::vector<Gradients>& grads, size_t rows, float learning_rate);
+    float infer(const float* x) const;
+
     float sigmoid(float x);
     float sigmoid_derivative(float x);
     float forward(const std::vector<float>& x);
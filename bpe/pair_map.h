@@ -0,0 +1,168 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "bpe.h"
+
+namespace bpe {
+
+// Both halves of a pair in one 64-bit key, left token in the high half
+inline uint64_t pack_pair(const Pair& p) {
+    return (static_cast<uint64_t>(p.l) << 32) | p.r;
+}
+
+inline Pair unpack_pair(uint64_t key) {
+    return Pair{ static_cast<uint32_t>(key >> 32), static_cast<uint32_t>(key) };
+}
+
+// MurmurHash3's 64-bit finalizer. Every key bit affects every hash bit, so runs of small token
+// IDs and swapped pairs like (a, b) / (b, a) spread over the whole table.
+inline uint64_t mix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/// <summary>
+/// Hash map from Pair to Value for the training and encoding hot loops. Entries are (packed key,
+/// value) slots in one flat array with linear probing, so there is no allocation per pair and a
+/// lookup is usually one cache line. The table stays at most half full. clear() keeps the slots,
+/// so a table refilled on every merge iteration stops reallocating once it has grown. erase()
+/// shifts the rest of the probe run back instead of leaving tombstones.
+/// The pair (UINT32_MAX, UINT32_MAX) marks empty slots and cannot be stored. References returned
+/// by operator[] and find() are invalidated by the next insertion or erase.
+/// </summary>
+template<class Value>
+class PairMap {
+    static const uint64_t EMPTY = UINT64_MAX;
+    struct Slot {
+        uint64_t key = EMPTY;
+        Value value{};
+    };
+    std::vector<Slot> slots; // size is 0 or a power of two
+    size_t count = 0;
+
+    size_t home(uint64_t key) const {
+        return static_cast<size_t>(mix64(key)) & (slots.size() - 1);
+    }
+
+    // slot holding key, or the empty slot where its probe run ends
+    size_t probe(uint64_t key) const {
+        size_t i = home(key);
+        while (slots[i].key != key && slots[i].key != EMPTY) i = (i + 1) & (slots.size() - 1);
+        return i;
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<Slot> old(capacity);
+        old.swap(slots);
+        for (auto& s : old) {
+            if (s.key == EMPTY) continue;
+            Slot& dst = slots[probe(s.key)];
+            dst.key = s.key;
+            dst.value = std::move(s.value);
+        }
+    }
+
+public:
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    size_t capacity() const {
+        return slots.size();
+    }
+
+    /// <summary>
+    /// Makes room for n entries without further growth.
+    /// </summary>
+    void reserve(size_t n) {
+        size_t capacity = 16;
+        while (capacity < 2 * n) capacity *= 2;
+        if (capacity > slots.size()) rehash(capacity);
+    }
+
+    /// <summary>
+    /// Removes every entry but keeps the allocated slots.
+    /// </summary>
+    void clear() {
+        if (count == 0) return;
+        for (auto& s : slots) {
+            if (s.key == EMPTY) continue;
+            s.key = EMPTY;
+            s.value = Value();
+        }
+        count = 0;
+    }
+
+    /// <summary>
+    /// Value for p, inserting Value() first if p is not in the map.
+    /// </summary>
+    Value& operator[](const Pair& p) {
+        const uint64_t key = pack_pair(p);
+        assert(key != EMPTY);
+        size_t i = slots.empty() ? 0 : probe(key);
+        if (!slots.empty() && slots[i].key == key) return slots[i].value;
+        // only a new key can need a bigger table
+        if (2 * (count + 1) > slots.size()) {
+            rehash(slots.empty() ? 16 : slots.size() * 2);
+            i = probe(key);
+        }
+        slots[i].key = key;
+        count++;
+        return slots[i].value;
+    }
+
+    Value* find(const Pair& p) {
+        if (count == 0) return nullptr;
+        Slot& s = slots[probe(pack_pair(p))];
+        return s.key == EMPTY ? nullptr : &s.value;
+    }
+
+    const Value* find(const Pair& p) const {
+        if (count == 0) return nullptr;
+        const Slot& s = slots[probe(pack_pair(p))];
+        return s.key == EMPTY ? nullptr : &s.value;
+    }
+
+    bool erase(const Pair& p) {
+        if (count == 0) return false;
+        const size_t mask = slots.size() - 1;
+        size_t hole = probe(pack_pair(p));
+        if (slots[hole].key == EMPTY) return false;
+        // move later entries of the run into the hole unless that would put them before their home slot
+        for (size_t j = (hole + 1) & mask; slots[j].key != EMPTY; j = (j + 1) & mask) {
+            const size_t h = home(slots[j].key);
+            const bool movable = hole <= j ? (h <= hole || h > j) : (h <= hole && h > j);
+            if (!movable) continue;
+            slots[hole].key = slots[j].key;
+            slots[hole].value = std::move(slots[j].value);
+            hole = j;
+        }
+        slots[hole].key = EMPTY;
+        slots[hole].value = Value();
+        count--;
+        return true;
+    }
+
+    /// <summary>
+    /// Calls f(pair, value) for every entry, in slot order.
+    /// </summary>
+    template<class F>
+    void for_each(F f) const {
+        for (const auto& s : slots) {
+            if (s.key != EMPTY) f(unpack_pair(s.key), s.value);
+        }
+    }
+};
+
+}
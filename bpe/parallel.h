@@ -0,0 +1,74 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bpe {
+
+// 0 means one thread per hardware thread
+inline size_t resolve_thread_count(size_t threads) {
+    if (threads != 0) return threads;
+    size_t hw = std::thread::hardware_concurrency();
+    return hw == 0 ? 1 : hw;
+}
+
+// Runs body(chunk) for every chunk in [0, chunks), one thread per chunk. The calling
+// thread runs chunk 0 so a single chunk never starts a thread.
+template<class F>
+void parallel_chunks(size_t chunks, F body) {
+    std::vector<std::thread> threads;
+    threads.reserve(chunks > 0 ? chunks - 1 : 0);
+    for (size_t c = 1; c < chunks; ++c) {
+        threads.emplace_back([&body, c] { body(c); });
+    }
+    if (chunks > 0) body(0);
+    for (auto& t : threads) t.join();
+}
+
+// Runs body(i) for every i in [0, count) on up to threads threads. Threads take the next
+// batch of indices from a shared counter, so uneven items do not leave threads idle.
+template<class F>
+void parallel_for(size_t count, size_t threads, size_t batch, F body) {
+    std::atomic<size_t> next(0);
+    size_t workers = std::min(resolve_thread_count(threads), (count + batch - 1) / batch);
+    parallel_chunks(workers, [&](size_t) {
+        for (;;) {
+            size_t begin = next.fetch_add(batch);
+            if (begin >= count) break;
+            size_t end = std::min(begin + batch, count);
+            for (size_t i = begin; i < end; ++i) body(i);
+        }
+    });
+}
+
+// Blocks each caller until count threads have called wait(), then releases them together.
+// Reusable, so threads can meet at the same barrier once per step.
+class Barrier {
+    std::mutex m;
+    std::condition_variable cv;
+    size_t count;
+    size_t waiting = 0;
+    size_t generation = 0;
+
+public:
+    explicit Barrier(size_t count) : count(count) {}
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(m);
+        size_t gen = generation;
+        if (++waiting == count) {
+            waiting = 0;
+            ++generation;
+            cv.notify_all();
+        }
+        else {
+            cv.wait(lock, [&] { return gen != generation; });
+        }
+    }
+};
+
+}
@@ -0,0 +1,260 @@
+#include "quantize.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+uint16_t float_to_half(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    const uint32_t sign = (x >> 16) & 0x8000;
+    const uint32_t float_exp = (x >> 23) & 0xff;
+    uint32_t mant = x & 0x7fffff;
+    if (float_exp == 0xff) return static_cast<uint16_t>(sign | 0x7c00 | (mant ? 0x200 : 0)); // inf / nan
+    const int32_t exp = static_cast<int32_t>(float_exp) - 127 + 15;
+    if (exp >= 31) return static_cast<uint16_t>(sign | 0x7c00); // too large, becomes inf
+
+    uint32_t half, rem, mid;
+    if (exp <= 0) {
+        // subnormal half (or zero), shift the mantissa with its implicit bit into place
+        if (exp < -10) return static_cast<uint16_t>(sign);
+        mant |= 0x800000;
+        const uint32_t shift = static_cast<uint32_t>(14 - exp);
+        half = mant >> shift;
+        rem = mant & ((1u << shift) - 1);
+        mid = 1u << (shift - 1);
+    }
+    else {
+        half = (static_cast<uint32_t>(exp) << 10) | (mant >> 13);
+        rem = mant & 0x1fff;
+        mid = 0x1000;
+    }
+    // round to nearest even, a carry into the exponent is still the correct result
+    if (rem > mid || (rem == mid && (half & 1))) half++;
+    return static_cast<uint16_t>(sign | half);
+}
+
+float half_to_float(uint16_t h) {
+    const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t x;
+    if (exp == 0) {
+        if (mant == 0) {
+            x = sign;
+        }
+        else {
+            // subnormal half, normalise it for the float exponent range
+            exp = 1;
+            while (!(mant & 0x400)) {
+                mant <<= 1;
+                exp--;
+            }
+            mant &= 0x3ff;
+            x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+        }
+    }
+    else if (exp == 31) {
+        x = sign | 0x7f800000 | (mant << 13);
+    }
+    else {
+        x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// Symmetric int8 quantization of values[0..n), returns the scale (value = q * scale)
+static float quantize_int8(const float* values, size_t n, int8_t* out) {
+    float max_abs = 0.0f;
+    for (size_t i = 0; i < n; ++i) max_abs = std::max(max_abs, std::fabs(values[i]));
+    const float scale = max_abs > 0.0f ? max_abs / 127.0f : 1.0f;
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = static_cast<int8_t>(std::lround(std::min(127.0f, std::max(-127.0f, values[i] / scale))));
+    }
+    return scale;
+}
+
+QuantizedEmbeddingTable::QuantizedEmbeddingTable() {}
+
+QuantizedEmbeddingTable::QuantizedEmbeddingTable(const EmbeddingTable& table, Precision precision)
+    : precision(precision), rows(table.get_rows()), dim(table.get_dim()) {
+    if (precision == Precision::Int8) {
+        q8.resize(rows * dim);
+        scales.resize(rows);
+        for (size_t r = 0; r < rows; ++r) {
+            scales[r] = quantize_int8(table.row(static_cast<uint32_t>(r)), dim, q8.data() + r * dim);
+        }
+    }
+    else {
+        q16.resize(rows * dim);
+        for (size_t r = 0; r < rows; ++r) {
+            const float* row = table.row(static_cast<uint32_t>(r));
+            for (size_t j = 0; j < dim; ++j) q16[r * dim + j] = float_to_half(row[j]);
+        }
+    }
+}
+
+size_t QuantizedEmbeddingTable::get_rows() const {
+    return rows;
+}
+
+size_t QuantizedEmbeddingTable::get_dim() const {
+    return dim;
+}
+
+Precision QuantizedEmbeddingTable::get_precision() const {
+    return precision;
+}
+
+size_t QuantizedEmbeddingTable::memory_bytes() const {
+    return q8.size() * sizeof(int8_t) + q16.size() * sizeof(uint16_t) + scales.size() * sizeof(float);
+}
+
+void QuantizedEmbeddingTable::add_row(uint32_t token, float* acc) const {
+    if (token >= rows) return;
+    if (precision == Precision::Int8) {
+        const int8_t* q = q8.data() + static_cast<size_t>(token) * dim;
+        const float scale = scales[token];
+        for (size_t j = 0; j < dim; ++j) acc[j] += scale * q[j];
+    }
+    else {
+        const uint16_t* q = q16.data() + static_cast<size_t>(token) * dim;
+        for (size_t j = 0; j < dim; ++j) acc[j] += half_to_float(q[j]);
+    }
+}
+
+template<class Token>
+void QuantizedEmbeddingTable::embed_and_average(const Token* tokens, size_t count, float* out) const {
+    std::fill(out, out + dim, 0.0f);
+    for (size_t i = 0; i < count; ++i) add_row(tokens[i], out);
+    for (size_t j = 0; j < dim; ++j) out[j] = count > 0 ? out[j] / static_cast<float>(count) : 0.0f;
+}
+
+template<class Token>
+size_t QuantizedEmbeddingTable::embed_and_average(const Token* tokens, size_t count, const uint8_t* mask, size_t mask_size, float* out) const {
+    std::fill(out, out + dim, 0.0f);
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t t = tokens[i];
+        if (t >= mask_size || mask[t] == 0) continue;
+        ++kept;
+        add_row(t, out);
+    }
+    for (size_t j = 0; j < dim; ++j) out[j] = kept > 0 ? out[j] / static_cast<float>(kept) : 0.0f;
+    return kept;
+}
+
+template void QuantizedEmbeddingTable::embed_and_average<uint16_t>(const uint16_t*, size_t, float*) const;
+template void QuantizedEmbeddingTable::embed_and_average<uint32_t>(const uint32_t*, size_t, float*) const;
+template size_t QuantizedEmbeddingTable::embed_and_average<uint16_t>(const uint16_t*, size_t, const uint8_t*, size_t, float*) const;
+template size_t QuantizedEmbeddingTable::embed_and_average<uint32_t>(const uint32_t*, size_t, const uint8_t*, size_t, float*) const;
+
+QuantizedNetwork::QuantizedNetwork() {}
+
+QuantizedNetwork::QuantizedNetwork(const NeuralNetwork& nn, Precision precision)
+    : precision(precision), input_size(nn.get_input_size()) {
+    const std::vector<float> weights = nn.get_weights();
+    const float* w1 = weights.data();
+    const float* w2 = w1 + input_size;
+    if (precision == Precision::Int8) {
+        q8.resize(2 * input_size);
+        scale_1 = quantize_int8(w1, input_size, q8.data());
+        scale_2 = quantize_int8(w2, input_size, q8.data() + input_size);
+    }
+    else {
+        q16.resize(2 * input_size);
+        for (size_t i = 0; i < 2 * input_size; ++i) q16[i] = float_to_half(w1[i]);
+    }
+    const float* tail = w1 + 2 * input_size;
+    b_hidden_1 = tail[0];
+    b_hidden_2 = tail[1];
+    w_h_output_1 = tail[2];
+    w_h_output_2 = tail[3];
+    b_output = tail[4];
+}
+
+// Dot products of x against two dequantized weight vectors. Four partial sums per vector keep
+// the adds independent so the loop is not one long dependency chain.
+template<class T, class Dequantize>
+static void dot2_quantized(const float* x, const T* q1, const T* q2, size_t n, Dequantize dq, float& d1, float& d2) {
+    float a[4] = { 0, 0, 0, 0 }, b[4] = { 0, 0, 0, 0 };
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (int k = 0; k < 4; ++k) {
+            a[k] += x[i + k] * dq(q1[i + k]);
+            b[k] += x[i + k] * dq(q2[i + k]);
+        }
+    }
+    for (; i < n; ++i) {
+        a[0] += x[i] * dq(q1[i]);
+        b[0] += x[i] * dq(q2[i]);
+    }
+    d1 = (a[0] + a[1]) + (a[2] + a[3]);
+    d2 = (b[0] + b[1]) + (b[2] + b[3]);
+}
+
+// Same for int8 weights, widening 8 weights at a time to float with SSE2 where available
+static void dot2_int8(const float* x, const int8_t* q1, const int8_t* q2, size_t n, float& d1, float& d2) {
+    size_t i = 0;
+    d1 = d2 = 0.0f;
+#if defined(__SSE2__) || defined(_M_X64)
+    // sign-extend the low 8 bytes of v to two vectors of 4 floats
+    auto widen = [](__m128i v, __m128& lo, __m128& hi) {
+        __m128i v16 = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+        lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v16, v16), 16));
+        hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v16, v16), 16));
+    };
+    __m128 s1 = _mm_setzero_ps(), s2 = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        __m128 a_lo, a_hi, b_lo, b_hi;
+        widen(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(q1 + i)), a_lo, a_hi);
+        widen(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(q2 + i)), b_lo, b_hi);
+        __m128 x_lo = _mm_loadu_ps(x + i), x_hi = _mm_loadu_ps(x + i + 4);
+        s1 = _mm_add_ps(s1, _mm_add_ps(_mm_mul_ps(x_lo, a_lo), _mm_mul_ps(x_hi, a_hi)));
+        s2 = _mm_add_ps(s2, _mm_add_ps(_mm_mul_ps(x_lo, b_lo), _mm_mul_ps(x_hi, b_hi)));
+    }
+    float t1[4], t2[4];
+    _mm_storeu_ps(t1, s1);
+    _mm_storeu_ps(t2, s2);
+    d1 = (t1[0] + t1[1]) + (t1[2] + t1[3]);
+    d2 = (t2[0] + t2[1]) + (t2[2] + t2[3]);
+#endif
+    float r1, r2;
+    dot2_quantized(x + i, q1 + i, q2 + i, n - i, [](int8_t q) { return static_cast<float>(q); }, r1, r2);
+    d1 += r1;
+    d2 += r2;
+}
+
+float QuantizedNetwork::predict(const float* x) const {
+    float h1, h2;
+    if (precision == Precision::Int8) {
+        dot2_int8(x, q8.data(), q8.data() + input_size, input_size, h1, h2);
+        h1 *= scale_1;
+        h2 *= scale_2;
+    }
+    else {
+        dot2_quantized(x, q16.data(), q16.data() + input_size, input_size, half_to_float, h1, h2);
+    }
+    const float h1_out = 1.f / (1.f + std::exp(-(h1 + b_hidden_1)));
+    const float h2_out = 1.f / (1.f + std::exp(-(h2 + b_hidden_2)));
+    return 1.f / (1.f + std::exp(-(h1_out * w_h_output_1 + h2_out * w_h_output_2 + b_output)));
+}
+
+void QuantizedNetwork::predict_batch(const float* X, size_t rows, float* out, size_t threads) const {
+    bpe::parallel_for(rows, threads, 256, [&](size_t i) {
+        out[i] = predict(X + i * input_size);
+    });
+}
+
+size_t QuantizedNetwork::get_input_size() const {
+    return input_size;
+}
+
+size_t QuantizedNetwork::memory_bytes() const {
+    return q8.size() * sizeof(int8_t) + q16.size() * sizeof(uint16_t) + 7 * sizeof(float);
+}
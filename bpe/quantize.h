@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "embedding_table.h"
+#include "nn.h"
+
+enum class Precision {
+    Float16, // IEEE half, ~3 significant digits, half the memory of float
+    Int8     // symmetric int8 with one float scale per vector, a quarter of the memory
+};
+
+uint16_t float_to_half(float f);
+float half_to_float(uint16_t h);
+
+/// <summary>
+/// Read-only copy of an EmbeddingTable stored as fp16 or int8 (one scale per row). Averages are
+/// computed in float, so results match the float table to within the quantization error.
+/// </summary>
+class QuantizedEmbeddingTable {
+    Precision precision = Precision::Int8;
+    size_t rows = 0;
+    size_t dim = 0;
+    std::vector<int8_t> q8;
+    std::vector<uint16_t> q16;
+    std::vector<float> scales; // int8 only, value = q * scale
+
+    void add_row(uint32_t token, float* acc) const;
+
+public:
+    QuantizedEmbeddingTable();
+    QuantizedEmbeddingTable(const EmbeddingTable& table, Precision precision);
+
+    size_t get_rows() const;
+    size_t get_dim() const;
+    Precision get_precision() const;
+    size_t memory_bytes() const;
+
+    /// <summary>
+    /// Same contract as EmbeddingTable::embed_and_average: tokens outside the table count as zero
+    /// vectors, and with a mask only tokens t with t &lt; mask_size and mask[t] != 0 are averaged.
+    /// </summary>
+    template<class Token>
+    void embed_and_average(const Token* tokens, size_t count, float* out) const;
+    template<class Token>
+    size_t embed_and_average(const Token* tokens, size_t count, const uint8_t* mask, size_t mask_size, float* out) const;
+};
+
+/// <summary>
+/// Read-only copy of a trained NeuralNetwork with the input-layer weights stored as fp16 or int8.
+/// The few hidden/output scalars stay float. predict is const and safe to share across threads.
+/// </summary>
+class QuantizedNetwork {
+    Precision precision = Precision::Int8;
+    size_t input_size = 0;
+    std::vector<int8_t> q8;     // w_hidden_1 then w_hidden_2
+    std::vector<uint16_t> q16;
+    float scale_1 = 1.0f, scale_2 = 1.0f;
+    float b_hidden_1 = 0, b_hidden_2 = 0, w_h_output_1 = 0, w_h_output_2 = 0, b_output = 0;
+
+public:
+    QuantizedNetwork();
+    QuantizedNetwork(const NeuralNetwork& nn, Precision precision);
+
+    float predict(const float* x) const;
+    void predict_batch(const float* X, size_t rows, float* out, size_t threads = 1) const;
+
+    size_t get_input_size() const;
+    size_t memory_bytes() const;
+};
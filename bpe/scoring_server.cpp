@@ -0,0 +1,354 @@
+#include "scoring_server.h"
+#include "parallel.h"
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <memory>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+std::string ServerStats::to_string() const {
+    std::ostringstream out;
+    out << "requests=" << requests << " batches=" << batches
+        << " mean_batch=" << (batches > 0 ? static_cast<double>(requests) / batches : 0.0)
+        << " p50_us=" << p50_us << " p99_us=" << p99_us << " max_us=" << max_us
+        << " throughput=" << throughput << "/s";
+    return out.str();
+}
+
+ScoringServer::ScoringServer(const Model& model, const ServerOptions& options)
+    : model(model), options(options), started(std::chrono::steady_clock::now()) {
+    latencies_us.reserve(LATENCY_WINDOW);
+    const size_t count = bpe::resolve_thread_count(options.workers);
+    for (size_t i = 0; i < count; ++i) workers.emplace_back([this] { worker_loop(); });
+}
+
+ScoringServer::~ScoringServer() {
+    stop();
+}
+
+std::future<float> ScoringServer::submit(std::string text) {
+    Request request;
+    request.text = std::move(text);
+    request.queued = std::chrono::steady_clock::now();
+    std::future<float> result = request.result.get_future();
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        // no worker would ever take it, so fail it now rather than leave the future waiting
+        if (stopping) {
+            request.result.set_exception(std::make_exception_ptr(std::runtime_error("scoring server is stopped")));
+            return result;
+        }
+        queue.push_back(std::move(request));
+    }
+    queue_ready.notify_one();
+    return result;
+}
+
+void ScoringServer::worker_loop() {
+    const size_t max_batch = std::max<size_t>(1, options.max_batch);
+    std::vector<Request> batch;
+    std::vector<std::string> texts;
+    std::vector<float> scores;
+    std::vector<float> batch_latencies;
+    for (;;) {
+        batch.clear();
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_ready.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (queue.empty()) return; // stopping and drained
+            // hold the first request briefly so concurrent ones can join its batch
+            if (queue.size() < max_batch && options.max_wait_us > 0 && !stopping) {
+                queue_ready.wait_for(lock, std::chrono::microseconds(options.max_wait_us),
+                    [&] { return stopping || queue.size() >= max_batch; });
+            }
+            const size_t n = std::min(max_batch, queue.size());
+            for (size_t i = 0; i < n; ++i) {
+                batch.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+        }
+        if (batch.empty()) continue; // another worker took them while this one waited
+
+        // one featurize + predict pass over the whole batch
+        texts.clear();
+        for (auto& request : batch) texts.push_back(std::move(request.text));
+        scores.resize(texts.size());
+        model.score_batch(texts, scores.data());
+
+        batch_latencies.clear();
+        for (size_t i = 0; i < batch.size(); ++i) {
+            Request& request = batch[i];
+            request.result.set_value(scores[i]);
+            batch_latencies.push_back(std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - request.queued).count());
+        }
+        record(batch_latencies);
+    }
+}
+
+void ScoringServer::record(const std::vector<float>& batch_latencies_us) {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    for (float us : batch_latencies_us) {
+        if (latencies_us.size() < LATENCY_WINDOW) latencies_us.push_back(us);
+        else latencies_us[completed % LATENCY_WINDOW] = us;
+        ++completed;
+    }
+    ++batches;
+}
+
+ServerStats ScoringServer::stats() const {
+    ServerStats s;
+    std::vector<float> window;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        s.requests = completed;
+        s.batches = batches;
+        window = latencies_us;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    s.throughput = seconds > 0 ? s.requests / seconds : 0.0;
+    if (!window.empty()) {
+        auto percentile = [&](double p) {
+            auto nth = window.begin() + static_cast<size_t>(p * (window.size() - 1));
+            std::nth_element(window.begin(), nth, window.end());
+            return static_cast<double>(*nth);
+        };
+        s.p50_us = percentile(0.50);
+        s.p99_us = percentile(0.99);
+        s.max_us = *std::max_element(window.begin(), window.end());
+    }
+    return s;
+}
+
+void ScoringServer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (stopping && workers.empty()) return;
+        stopping = true;
+    }
+    queue_ready.notify_all();
+    for (auto& t : workers) t.join();
+    workers.clear();
+
+    ServerStats s = stats();
+    trace::counter("server.requests", static_cast<double>(s.requests));
+    trace::counter("server.p50_us", s.p50_us);
+    trace::counter("server.p99_us", s.p99_us);
+    trace::counter("server.throughput", s.throughput);
+}
+
+// Reads requests with read_line and answers them with write, in order. A writer thread waits on
+// each answer in turn while this thread keeps queueing, so requests from one stream overlap.
+void ScoringServer::serve_lines(const std::function<bool(std::string&)>& read_line, const std::function<bool(const std::string&)>& write) {
+    struct Pending {
+        bool is_stats;
+        std::future<float> score;
+    };
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<Pending> pending;
+    bool done = false;
+
+    std::thread writer([&] {
+        bool open = true;
+        for (;;) {
+            Pending next;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&] { return done || !pending.empty(); });
+                if (pending.empty()) return;
+                next = std::move(pending.front());
+                pending.pop_front();
+            }
+            std::string answer;
+            if (next.is_stats) {
+                answer = stats().to_string();
+            }
+            else {
+                try {
+                    float p = next.score.get();
+                    char buffer[32];
+                    std::snprintf(buffer, sizeof(buffer), "%s\t%g", p > 0.5f ? "spam" : "ham", p);
+                    answer = buffer;
+                }
+                catch (const std::exception& e) {
+                    answer = std::string("error\t") + e.what();
+                }
+            }
+            // keep draining after the peer goes away so every future is consumed
+            if (open) open = write(answer + "\n");
+        }
+    });
+
+    std::string line;
+    while (read_line(line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        Pending p;
+        p.is_stats = line == "!stats";
+        if (!p.is_stats) p.score = submit(line);
+        {
+            std::lock_guard<std::mutex> lock(m);
+            pending.push_back(std::move(p));
+        }
+        cv.notify_one();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m);
+        done = true;
+    }
+    cv.notify_one();
+    writer.join();
+}
+
+void ScoringServer::serve_stream(std::istream& in, std::ostream& out) {
+    serve_lines(
+        [&](std::string& line) { return static_cast<bool>(std::getline(in, line)); },
+        [&](const std::string& answer) { out << answer << std::flush; return static_cast<bool>(out); });
+}
+
+#ifdef _WIN32
+
+bool ScoringServer::serve_socket(const std::string& path) {
+    std::cerr << "Error: Unix socket serving is not supported on Windows: " << path << std::endl;
+    return false;
+}
+
+#else
+
+static std::atomic<bool> interrupted(false);
+
+static void on_signal(int) {
+    interrupted = true;
+}
+
+// Line reader and writer over a connected socket
+struct SocketLines {
+    int fd;
+    std::string buffer;
+    size_t consumed = 0;
+
+    bool read_line(std::string& line) {
+        for (;;) {
+            size_t newline = buffer.find('\n', consumed);
+            if (newline != std::string::npos) {
+                line.assign(buffer, consumed, newline - consumed);
+                consumed = newline + 1;
+                return true;
+            }
+            buffer.erase(0, consumed);
+            consumed = 0;
+            char chunk[4096];
+            ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) {
+                // a last line without a newline still counts
+                if (buffer.empty()) return false;
+                line.swap(buffer);
+                buffer.clear();
+                return true;
+            }
+            buffer.append(chunk, static_cast<size_t>(n));
+        }
+    }
+
+    bool write(const std::string& answer) {
+        size_t sent = 0;
+        while (sent < answer.size()) {
+            ssize_t n = ::send(fd, answer.data() + sent, answer.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) return false;
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+};
+
+bool ScoringServer::serve_socket(const std::string& path) {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Error: Socket path too long: " << path << std::endl;
+        return false;
+    }
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::cerr << "Error: Cannot create socket" << std::endl;
+        return false;
+    }
+    address.sun_family = AF_UNIX;
+    std::copy(path.begin(), path.end(), address.sun_path);
+    ::unlink(path.c_str());
+    if (::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listener, 64) != 0) {
+        std::cerr << "Error: Cannot listen on socket: " << path << std::endl;
+        ::close(listener);
+        return false;
+    }
+
+    interrupted = false;
+    auto previous_int = std::signal(SIGINT, on_signal);
+    auto previous_term = std::signal(SIGTERM, on_signal);
+
+    struct Connection {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> finished;
+    };
+    std::vector<Connection> connections;
+    std::mutex open_mutex;
+    std::vector<int> open_fds;
+
+    while (!interrupted) {
+        // join connections that have closed so a long-running server does not collect threads
+        for (auto it = connections.begin(); it != connections.end();) {
+            if (*it->finished) {
+                it->thread.join();
+                it = connections.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        // wake up regularly so a signal is noticed even without new connections
+        pollfd pfd{ listener, POLLIN, 0 };
+        if (::poll(&pfd, 1, 200) <= 0) continue;
+        int fd = ::accept(listener, nullptr, nullptr);
+        if (fd < 0) continue;
+
+        auto finished = std::make_shared<std::atomic<bool>>(false);
+        {
+            std::lock_guard<std::mutex> lock(open_mutex);
+            open_fds.push_back(fd);
+        }
+        connections.push_back({ std::thread([this, fd, finished, &open_mutex, &open_fds] {
+            SocketLines lines{ fd, {}, 0 };
+            serve_lines(
+                [&](std::string& line) { return lines.read_line(line); },
+                [&](const std::string& answer) { return lines.write(answer); });
+            {
+                std::lock_guard<std::mutex> lock(open_mutex);
+                open_fds.erase(std::find(open_fds.begin(), open_fds.end(), fd));
+                ::close(fd);
+            }
+            *finished = true;
+        }), finished });
+    }
+
+    // stop taking requests; connections still open stop reading but answer what they already sent
+    ::close(listener);
+    ::unlink(path.c_str());
+    {
+        std::lock_guard<std::mutex> lock(open_mutex);
+        for (int fd : open_fds) ::shutdown(fd, SHUT_RD);
+    }
+    for (auto& c : connections) c.thread.join();
+    std::signal(SIGINT, previous_int);
+    std::signal(SIGTERM, previous_term);
+    return true;
+}
+
+#endif
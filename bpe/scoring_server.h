@@ -0,0 +1,97 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "model.h"
+
+struct ServerOptions {
+    size_t workers = 0;          // scoring threads, 0 = one per hardware thread
+    size_t max_batch = 32;       // most queued requests one worker takes at a time
+    unsigned max_wait_us = 50;   // how long a worker holding fewer than max_batch waits for more, 0 = never
+};
+
+struct ServerStats {
+    uint64_t requests = 0;       // completed since start
+    uint64_t batches = 0;
+    double p50_us = 0.0;         // queue + scoring latency over the most recent requests
+    double p99_us = 0.0;
+    double max_us = 0.0;
+    double throughput = 0.0;     // completed requests per second since start
+
+    std::string to_string() const;
+};
+
+/// <summary>
+/// Long-lived scorer around a loaded Model. Requests are queued and picked up in batches by a
+/// pool of worker threads; each batch is featurized into one matrix and scored with a single
+/// Model::score_batch call. Requests can
+/// come from code (submit), from a stream such as stdin, or from clients on a Unix domain socket.
+/// Stream and socket requests are one message per line, answered in order with
+/// "spam|ham&lt;TAB&gt;probability", or "error&lt;TAB&gt;reason" for a request that could not be scored.
+/// A line reading exactly "!stats" is answered with the current stats.
+/// </summary>
+class ScoringServer {
+    struct Request {
+        std::string text;
+        std::promise<float> result;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    const Model& model;
+    ServerOptions options;
+    std::mutex queue_mutex;
+    std::condition_variable queue_ready;
+    std::deque<Request> queue;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    static const size_t LATENCY_WINDOW = 1 << 16;
+    mutable std::mutex stats_mutex;
+    std::vector<float> latencies_us; // ring of the last LATENCY_WINDOW latencies
+    uint64_t completed = 0;
+    uint64_t batches = 0;
+    std::chrono::steady_clock::time_point started;
+
+    void worker_loop();
+    void record(const std::vector<float>& batch_latencies_us);
+    void serve_lines(const std::function<bool(std::string&)>& read_line, const std::function<bool(const std::string&)>& write);
+
+public:
+    explicit ScoringServer(const Model& model, const ServerOptions& options = ServerOptions());
+    ~ScoringServer();
+    ScoringServer(const ScoringServer&) = delete;
+    ScoringServer& operator=(const ScoringServer&) = delete;
+
+    /// <summary>
+    /// Queues one message; the future yields its spam probability. After stop the future holds a
+    /// std::runtime_error instead.
+    /// </summary>
+    std::future<float> submit(std::string text);
+
+    /// <summary>
+    /// Serves one request per line of in until it ends, writing answers to out in request order.
+    /// Reading continues while earlier requests are scored, so a busy stream is batched.
+    /// </summary>
+    void serve_stream(std::istream& in, std::ostream& out);
+
+    /// <summary>
+    /// Listens on a Unix domain socket at path and serves every connection like serve_stream until
+    /// SIGINT or SIGTERM. Not available on Windows.
+    /// </summary>
+    bool serve_socket(const std::string& path);
+
+    /// <summary>
+    /// Finishes queued requests and joins the workers. Called by the destructor.
+    /// </summary>
+    void stop();
+
+    ServerStats stats() const;
+};
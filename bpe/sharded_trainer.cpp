@@ -0,0 +1,261 @@
+#include "sharded_trainer.h"
+#include "csv_reader.h"
+#include "mapped_file.h"
+#include "merge_state.h"
+#include "pair_map.h"
+#include "trace.h"
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace bpe {
+
+// what goes over the pipes, plain structs in native byte order since both ends are the same binary
+struct WireDelta {
+    uint32_t l, r;
+    int64_t delta;
+};
+
+struct WireMerge {
+    uint32_t l, r;
+    uint32_t new_token;
+    uint32_t stop;
+};
+
+// First line start at or after pos
+static size_t line_start(const char* data, size_t size, size_t pos) {
+    if (pos == 0 || pos >= size || data[pos - 1] == '\n') return std::min(pos, size);
+    const char* newline = find_newline(data + pos, data + size);
+    return newline == data + size ? size : static_cast<size_t>(newline - data) + 1;
+}
+
+// Reads the lines that start inside this worker's byte range of every file. A line that
+// straddles a range boundary belongs to the worker whose range holds its first byte. The lines
+// are split by parse_records, the same parser read_csv uses.
+static void read_slice(const std::vector<std::string>& files, size_t worker, size_t workers, const std::string& delimiter, Uint32Array& tokens) {
+    std::vector<CsvRecord> records;
+    for (const auto& file : files) {
+        MappedFile mapped;
+        if (!mapped.open(file)) continue;
+        const char* data = mapped.data();
+        const size_t size = mapped.size();
+        const size_t begin = line_start(data, size, static_cast<size_t>(uint64_t(size) * worker / workers));
+        const size_t end = line_start(data, size, static_cast<size_t>(uint64_t(size) * (worker + 1) / workers));
+        records.clear();
+        parse_records(data + begin, end - begin, delimiter, records, 1);
+        for (const auto& record : records) {
+            for (char c : record.text) {
+                tokens.push_back(static_cast<uint8_t>(c));
+            }
+            tokens.push_back(SEPARATOR);
+        }
+    }
+}
+
+static void add_base_pairs(PairArray& pairs) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        pairs.push_back(Pair{ i, 0 });
+    }
+}
+
+static bool vocab_full(const PairArray& pairs, size_t max_vocab_size) {
+    return max_vocab_size != 0 && pairs.size() >= max_vocab_size;
+}
+
+#ifndef _WIN32
+
+static bool write_all(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = ::write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool read_all(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = ::read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool send_deltas(int fd, const std::vector<WireDelta>& deltas) {
+    uint64_t count = deltas.size();
+    return write_all(fd, &count, sizeof(count))
+        && write_all(fd, deltas.data(), deltas.size() * sizeof(WireDelta));
+}
+
+static bool receive_deltas(int fd, MergeQueue& queue) {
+    uint64_t count = 0;
+    if (!read_all(fd, &count, sizeof(count))) return false;
+    std::vector<WireDelta> deltas(count);
+    if (!read_all(fd, deltas.data(), deltas.size() * sizeof(WireDelta))) return false;
+    for (const auto& d : deltas) {
+        queue.add(Pair{ d.l, d.r }, d.delta);
+    }
+    return true;
+}
+
+static void run_worker(const std::vector<std::string>& files, size_t worker, const ShardOptions& options, int in_fd, int out_fd) {
+    Uint32Array tokens;
+    read_slice(files, worker, options.workers, options.delimiter, tokens);
+    MergeState state(std::move(tokens));
+
+    std::vector<WireDelta> wire;
+    for (const auto& d : state.initial_counts()) {
+        wire.push_back({ d.pair.l, d.pair.r, d.delta });
+    }
+    if (!send_deltas(out_fd, wire)) return;
+
+    PairMap<int64_t> summed;
+    WireMerge cmd;
+    while (read_all(in_fd, &cmd, sizeof(cmd)) && !cmd.stop) {
+        // fold the +1/-1 changes so each pair crosses the pipe once per merge
+        summed.clear();
+        for (const auto& d : state.merge(Pair{ cmd.l, cmd.r }, cmd.new_token)) {
+            summed[d.pair] += d.delta;
+        }
+        wire.clear();
+        summed.for_each([&](const Pair& p, int64_t delta) {
+            if (delta != 0) wire.push_back({ p.l, p.r, delta });
+        });
+        if (!send_deltas(out_fd, wire)) return;
+    }
+}
+
+bool learn_merges_sharded(const std::vector<std::string>& files, PairArray& pairs, const ShardOptions& options) {
+    trace::ScopedTimer timer("bpe.train_sharded", "bpe");
+    for (const auto& file : files) {
+        if (!std::ifstream(file)) {
+            std::cerr << "Error: Cannot open training file: " << file << std::endl;
+            return false;
+        }
+    }
+    const size_t workers = options.workers == 0 ? 1 : options.workers;
+    ShardOptions worker_options = options;
+    worker_options.workers = workers;
+
+    struct Worker {
+        pid_t pid;
+        int to_worker;
+        int from_worker;
+    };
+    std::vector<Worker> pool;
+    // a dead worker must show up as a failed write, not kill the coordinator
+    void (*old_sigpipe)(int) = std::signal(SIGPIPE, SIG_IGN);
+    std::cout.flush();
+    std::cerr.flush();
+
+    bool ok = true;
+    for (size_t w = 0; w < workers && ok; ++w) {
+        int down[2], up[2];
+        if (pipe(down) != 0) { ok = false; break; }
+        if (pipe(up) != 0) { close(down[0]); close(down[1]); ok = false; break; }
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(down[0]); close(down[1]); close(up[0]); close(up[1]);
+            ok = false;
+            break;
+        }
+        if (pid == 0) {
+            // keep only this worker's ends, otherwise earlier workers never see EOF
+            for (const auto& other : pool) {
+                close(other.to_worker);
+                close(other.from_worker);
+            }
+            close(down[1]);
+            close(up[0]);
+            run_worker(files, w, worker_options, down[0], up[1]);
+            close(down[0]);
+            close(up[1]);
+            _exit(0);
+        }
+        close(down[0]);
+        close(up[1]);
+        pool.push_back({ pid, down[1], up[0] });
+    }
+
+    MergeQueue queue;
+    for (const auto& worker : pool) {
+        ok = ok && receive_deltas(worker.from_worker, queue);
+    }
+
+    if (ok) add_base_pairs(pairs);
+    Pair merged;
+    size_t count;
+    while (ok && !vocab_full(pairs, options.max_vocab_size) && queue.pop_best(merged, count)) {
+        pairs.push_back(merged);
+        const uint32_t new_token = static_cast<uint32_t>(pairs.size() - 1);
+        if (options.on_merge) options.on_merge({ merged, new_token, count, 0 });
+        WireMerge cmd{ merged.l, merged.r, new_token, 0 };
+        for (const auto& worker : pool) {
+            ok = ok && write_all(worker.to_worker, &cmd, sizeof(cmd));
+        }
+        for (const auto& worker : pool) {
+            ok = ok && receive_deltas(worker.from_worker, queue);
+        }
+    }
+
+    WireMerge stop{ 0, 0, 0, 1 };
+    for (const auto& worker : pool) {
+        write_all(worker.to_worker, &stop, sizeof(stop));
+        close(worker.to_worker);
+        close(worker.from_worker);
+    }
+    for (const auto& worker : pool) {
+        int status = 0;
+        while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR) {}
+    }
+    std::signal(SIGPIPE, old_sigpipe);
+
+    if (!ok) std::cerr << "Error: Sharded training failed, a worker could not be started or stopped responding" << std::endl;
+    return ok;
+}
+
+#else
+
+// no fork on Windows, the shards are trained in this process instead
+bool learn_merges_sharded(const std::vector<std::string>& files, PairArray& pairs, const ShardOptions& options) {
+    trace::ScopedTimer timer("bpe.train_sharded", "bpe");
+    for (const auto& file : files) {
+        if (!std::ifstream(file)) {
+            std::cerr << "Error: Cannot open training file: " << file << std::endl;
+            return false;
+        }
+    }
+    Uint32Array tokens;
+    read_slice(files, 0, 1, options.delimiter, tokens);
+    MergeState state(std::move(tokens));
+    MergeQueue queue;
+    queue.add(state.initial_counts());
+
+    add_base_pairs(pairs);
+    Pair merged;
+    size_t count;
+    while (!vocab_full(pairs, options.max_vocab_size) && queue.pop_best(merged, count)) {
+        pairs.push_back(merged);
+        const uint32_t new_token = static_cast<uint32_t>(pairs.size() - 1);
+        if (options.on_merge) options.on_merge({ merged, new_token, count, 0 });
+        queue.add(state.merge(merged, new_token));
+    }
+    return true;
+}
+
+#endif
+
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "bpe.h"
+
+namespace bpe {
+
+struct ShardOptions {
+    size_t workers = 4;
+    size_t max_vocab_size = 0;  // 0 means merge until no pair repeats
+    std::string delimiter;      // if set, only the text after the first delimiter of a line is trained on
+    MergeCallback on_merge;     // tokens_before is not tracked here and is always 0
+};
+
+/// <summary>
+/// Learns merges over input files that do not need to fit in one process. Every line is a
+/// document, split by the same parse_records as read_csv: lines without the delimiter (when one
+/// is set) and empty lines are skipped and a trailing '\r' is dropped. Each worker process reads a byte range of every file, counts its pairs and
+/// sends them to the coordinator over a pipe. The coordinator picks each merge from the summed
+/// counts, broadcasts it, and workers answer with the count changes it caused in their slice.
+/// Gives the same pairs as learn_merges over the same lines.
+/// </summary>
+bool learn_merges_sharded(const std::vector<std::string>& files, PairArray& pairs, const ShardOptions& options);
+
+}
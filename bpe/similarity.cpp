@@ -0,0 +1,312 @@
+#include "similarity.h"
+#include "parallel.h"
+#include "trace.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const size_t QUERY_BLOCK = 8; // queries scored together so each row is loaded once per block
+
+size_t padded(size_t dim) {
+    return (dim + 7) / 8 * 8;
+}
+
+// Dot product of two stride-padded vectors, n is a multiple of 8
+inline float dot(const float* a, const float* b, size_t n) {
+#if defined(__AVX2__)
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < n; i += 8) sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    for (size_t i = 0; i < n; i += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    __m128 s = _mm_add_ps(s0, s1);
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+#else
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) sum += a[i] * b[i];
+    return sum;
+#endif
+}
+
+// Writes v / |v| into out (stride floats, zero padded). Zero vectors stay zero.
+void normalize_into(const float* v, size_t dim, size_t stride, float* out) {
+    double norm = 0.0;
+    for (size_t j = 0; j < dim; ++j) norm += static_cast<double>(v[j]) * v[j];
+    const float scale = norm > 1e-20 ? static_cast<float>(1.0 / std::sqrt(norm)) : 0.0f;
+    for (size_t j = 0; j < dim; ++j) out[j] = v[j] * scale;
+    std::fill(out + dim, out + stride, 0.0f);
+}
+
+bool better(const Neighbor& a, const Neighbor& b) {
+    return a.similarity > b.similarity || (a.similarity == b.similarity && a.id < b.id);
+}
+
+// The k best neighbours seen so far, kept as a heap with the worst on top
+class TopK {
+    size_t k = 0;
+    std::vector<Neighbor> heap;
+
+public:
+    void reset(size_t new_k) {
+        k = new_k;
+        heap.clear();
+    }
+    void push(uint32_t id, float similarity) {
+        Neighbor n{ id, similarity };
+        if (heap.size() < k) {
+            heap.push_back(n);
+            std::push_heap(heap.begin(), heap.end(), better);
+        }
+        else if (k > 0 && better(n, heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), better);
+            heap.back() = n;
+            std::push_heap(heap.begin(), heap.end(), better);
+        }
+    }
+    void take(std::vector<Neighbor>& out) {
+        std::sort(heap.begin(), heap.end(), better);
+        out.assign(heap.begin(), heap.end());
+    }
+};
+
+// Scores rows [begin, end) against each query of a normalised block. ids maps rows to
+// reported ids, nullptr reports the row number itself.
+void scan(const float* rows, size_t stride, size_t begin, size_t end, const uint32_t* ids, const float* block, size_t block_size, TopK* top) {
+    for (size_t r = begin; r < end; ++r) {
+        const float* row = rows + r * stride;
+        const uint32_t id = ids ? ids[r] : static_cast<uint32_t>(r);
+        for (size_t q = 0; q < block_size; ++q) top[q].push(id, dot(block + q * stride, row, stride));
+    }
+}
+
+}
+
+VectorIndex::VectorIndex(size_t dim) : dim(dim), stride(padded(dim)) {}
+
+void VectorIndex::add(const float* vectors, size_t count) {
+    const size_t first = size();
+    rows.resize((first + count) * stride);
+    for (size_t i = 0; i < count; ++i) normalize_into(vectors + i * dim, dim, stride, rows.data() + (first + i) * stride);
+}
+
+void VectorIndex::clear() {
+    rows.clear();
+}
+
+size_t VectorIndex::size() const {
+    return stride ? rows.size() / stride : 0;
+}
+
+size_t VectorIndex::get_dim() const {
+    return dim;
+}
+
+size_t VectorIndex::get_stride() const {
+    return stride;
+}
+
+const float* VectorIndex::vector(uint32_t id) const {
+    return rows.data() + static_cast<size_t>(id) * stride;
+}
+
+void VectorIndex::search_batch(const float* queries, size_t count, size_t k, std::vector<std::vector<Neighbor>>& results, size_t threads) const {
+    trace::ScopedTimer timer("similarity.flat_search", "similarity");
+    results.resize(count);
+    const size_t blocks = (count + QUERY_BLOCK - 1) / QUERY_BLOCK;
+    bpe::parallel_for(blocks, threads, 1, [&](size_t b) {
+        const size_t q0 = b * QUERY_BLOCK;
+        const size_t n = std::min(QUERY_BLOCK, count - q0);
+        thread_local std::vector<float> block;
+        thread_local std::vector<TopK> top(QUERY_BLOCK);
+        block.resize(QUERY_BLOCK * stride);
+        for (size_t q = 0; q < n; ++q) {
+            normalize_into(queries + (q0 + q) * dim, dim, stride, block.data() + q * stride);
+            top[q].reset(k);
+        }
+        scan(rows.data(), stride, 0, size(), nullptr, block.data(), n, top.data());
+        for (size_t q = 0; q < n; ++q) top[q].take(results[q0 + q]);
+    });
+}
+
+std::vector<Neighbor> VectorIndex::search(const float* query, size_t k) const {
+    std::vector<std::vector<Neighbor>> results;
+    search_batch(query, 1, k, results, 1);
+    return results[0];
+}
+
+IvfIndex::IvfIndex(const IvfOptions& options) : options(options) {}
+
+void IvfIndex::build(const float* data, size_t count, size_t dim, size_t threads) {
+    trace::ScopedTimer timer("similarity.ivf_build", "similarity");
+    VectorIndex all(dim);
+    all.add(data, count);
+    vectors = VectorIndex(dim);
+    centroids = VectorIndex(dim);
+    ids.clear();
+    position.clear();
+    list_start.assign(1, 0);
+    if (count == 0) return;
+
+    size_t lists = options.lists ? options.lists : static_cast<size_t>(std::sqrt(static_cast<double>(count)));
+    lists = std::max<size_t>(1, std::min(lists, count));
+
+    // spherical k-means on a sample: assign to the most similar centroid, re-average, repeat
+    std::mt19937 gen(options.seed);
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), gen);
+    const size_t samples = std::max(lists, std::min(count, options.train_sample));
+    std::vector<float> sample(samples * dim);
+    for (size_t i = 0; i < samples; ++i) std::copy(all.vector(order[i]), all.vector(order[i]) + dim, sample.begin() + i * dim);
+
+    std::vector<float> means(sample.begin(), sample.begin() + lists * dim);
+    std::vector<std::vector<Neighbor>> nearest;
+    for (size_t it = 0; it < options.iterations; ++it) {
+        centroids = VectorIndex(dim);
+        centroids.add(means.data(), lists);
+        centroids.search_batch(sample.data(), samples, 1, nearest, threads);
+        std::fill(means.begin(), means.end(), 0.0f);
+        std::vector<size_t> members(lists, 0);
+        for (size_t i = 0; i < samples; ++i) {
+            const uint32_t c = nearest[i].empty() ? 0 : nearest[i][0].id;
+            members[c]++;
+            for (size_t j = 0; j < dim; ++j) means[c * dim + j] += sample[i * dim + j];
+        }
+        // an empty cluster restarts from a random sample so no list is wasted
+        for (size_t c = 0; c < lists; ++c) {
+            if (members[c] == 0) {
+                const size_t s = gen() % samples;
+                std::copy(sample.begin() + s * dim, sample.begin() + (s + 1) * dim, means.begin() + c * dim);
+            }
+        }
+    }
+    centroids = VectorIndex(dim);
+    centroids.add(means.data(), lists);
+
+    // assign every vector and store each cluster's vectors together (counting sort by cluster)
+    centroids.search_batch(data, count, 1, nearest, threads);
+    std::vector<uint32_t> cluster(count);
+    list_start.assign(lists + 1, 0);
+    for (size_t i = 0; i < count; ++i) {
+        cluster[i] = nearest[i].empty() ? 0 : nearest[i][0].id;
+        list_start[cluster[i] + 1]++;
+    }
+    for (size_t c = 0; c < lists; ++c) list_start[c + 1] += list_start[c];
+    std::vector<size_t> fill(list_start.begin(), list_start.end() - 1);
+    ids.resize(count);
+    position.resize(count);
+    std::vector<float> grouped(count * dim);
+    for (size_t i = 0; i < count; ++i) {
+        const size_t row = fill[cluster[i]]++;
+        ids[row] = static_cast<uint32_t>(i);
+        position[i] = static_cast<uint32_t>(row);
+        std::copy(all.vector(static_cast<uint32_t>(i)), all.vector(static_cast<uint32_t>(i)) + dim, grouped.begin() + row * dim);
+    }
+    vectors.add(grouped.data(), count);
+    trace::counter("similarity.ivf_lists", static_cast<double>(lists));
+}
+
+size_t IvfIndex::size() const {
+    return vectors.size();
+}
+
+size_t IvfIndex::get_dim() const {
+    return vectors.get_dim();
+}
+
+size_t IvfIndex::get_lists() const {
+    return list_start.size() - 1;
+}
+
+void IvfIndex::set_probes(size_t probes) {
+    options.probes = probes;
+}
+
+const float* IvfIndex::vector(uint32_t id) const {
+    return vectors.vector(position[id]);
+}
+
+void IvfIndex::search_batch(const float* queries, size_t count, size_t k, std::vector<std::vector<Neighbor>>& results, size_t threads) const {
+    trace::ScopedTimer timer("similarity.ivf_search", "similarity");
+    results.resize(count);
+    if (size() == 0) {
+        for (auto& r : results) r.clear();
+        return;
+    }
+    std::vector<std::vector<Neighbor>> probes;
+    centroids.search_batch(queries, count, std::max<size_t>(1, options.probes), probes, threads);
+    const size_t dim = get_dim();
+    const size_t stride = vectors.get_stride();
+    bpe::parallel_for(count, threads, 16, [&](size_t q) {
+        thread_local std::vector<float> query;
+        thread_local TopK top;
+        query.resize(stride);
+        normalize_into(queries + q * dim, dim, stride, query.data());
+        top.reset(k);
+        for (const auto& list : probes[q]) {
+            scan(vectors.vector(0), stride, list_start[list.id], list_start[list.id + 1], ids.data(), query.data(), 1, &top);
+        }
+        top.take(results[q]);
+    });
+}
+
+std::vector<Neighbor> IvfIndex::search(const float* query, size_t k) const {
+    std::vector<std::vector<Neighbor>> results;
+    search_batch(query, 1, k, results, 1);
+    return results[0];
+}
+
+template<class Index>
+std::vector<DuplicatePair> find_near_duplicates(const Index& index, float threshold, size_t k, size_t threads) {
+    trace::ScopedTimer timer("similarity.near_duplicates", "similarity");
+    const size_t CHUNK = 4096;
+    const size_t dim = index.get_dim();
+    std::vector<DuplicatePair> pairs;
+    std::vector<float> queries;
+    std::vector<std::vector<Neighbor>> results;
+    for (size_t first = 0; first < index.size(); first += CHUNK) {
+        const size_t n = std::min(CHUNK, index.size() - first);
+        queries.resize(n * dim);
+        for (size_t i = 0; i < n; ++i) {
+            const float* v = index.vector(static_cast<uint32_t>(first + i));
+            std::copy(v, v + dim, queries.begin() + i * dim);
+        }
+        // k + 1 because every vector finds itself
+        index.search_batch(queries.data(), n, k + 1, results, threads);
+        for (size_t i = 0; i < n; ++i) {
+            const uint32_t id = static_cast<uint32_t>(first + i);
+            for (const auto& nb : results[i]) {
+                if (nb.id == id || nb.similarity < threshold) continue;
+                pairs.push_back({ std::min(id, nb.id), std::max(id, nb.id), nb.similarity });
+            }
+        }
+    }
+    // a pair is usually found from both ends, keep one
+    std::sort(pairs.begin(), pairs.end(), [](const DuplicatePair& x, const DuplicatePair& y) {
+        return x.a != y.a ? x.a < y.a : x.b < y.b;
+    });
+    pairs.erase(std::unique(pairs.begin(), pairs.end(), [](const DuplicatePair& x, const DuplicatePair& y) {
+        return x.a == y.a && x.b == y.b;
+    }), pairs.end());
+    return pairs;
+}
+
+template std::vector<DuplicatePair> find_near_duplicates<VectorIndex>(const VectorIndex&, float, size_t, size_t);
+template std::vector<DuplicatePair> find_near_duplicates<IvfIndex>(const IvfIndex&, float, size_t, size_t);
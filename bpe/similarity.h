@@ -0,0 +1,93 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Neighbor {
+    uint32_t id;       // row in the index
+    float similarity;  // cosine similarity to the query
+};
+
+struct DuplicatePair {
+    uint32_t a, b;     // a < b
+    float similarity;
+};
+
+/// <summary>
+/// Exact cosine-similarity search. Vectors are L2-normalised on insert and stored in one contiguous
+/// matrix with rows padded to 8 floats, so similarity is a plain SIMD dot product. Searching is const
+/// and safe from several threads once the index is built.
+/// </summary>
+class VectorIndex {
+    size_t dim = 0;
+    size_t stride = 0;
+    std::vector<float> rows; // size() * stride floats
+
+public:
+    explicit VectorIndex(size_t dim = 0);
+
+    /// <summary>
+    /// Appends count row-major vectors of dim floats. Ids continue from size().
+    /// </summary>
+    void add(const float* vectors, size_t count);
+    void clear();
+
+    size_t size() const;
+    size_t get_dim() const;
+    size_t get_stride() const;
+    const float* vector(uint32_t id) const; // normalised, stride floats
+
+    /// <summary>
+    /// The k most similar rows to each of count row-major queries, best first. Queries are scored
+    /// in blocks against every row, split across threads (0 = one per hardware thread).
+    /// </summary>
+    void search_batch(const float* queries, size_t count, size_t k, std::vector<std::vector<Neighbor>>& results, size_t threads = 0) const;
+    std::vector<Neighbor> search(const float* query, size_t k) const;
+};
+
+struct IvfOptions {
+    size_t lists = 0;        // coarse clusters, 0 = about sqrt(size)
+    size_t probes = 8;       // clusters scanned per query, more is slower and more exact
+    size_t iterations = 10;  // k-means rounds
+    size_t train_sample = 100000; // rows used to train the clusters
+    unsigned seed = 42;
+};
+
+/// <summary>
+/// Approximate cosine-similarity search (inverted file). k-means splits the vectors into clusters and
+/// a query only scans the vectors of its probes nearest clusters, so a search touches roughly
+/// probes / lists of the data. Each cluster's vectors are stored together for sequential scans.
+/// </summary>
+class IvfIndex {
+    IvfOptions options;
+    VectorIndex centroids;
+    VectorIndex vectors;           // grouped by cluster
+    std::vector<uint32_t> ids;     // original id of each row in vectors
+    std::vector<uint32_t> position; // row in vectors of each original id
+    std::vector<size_t> list_start; // cluster c owns rows [list_start[c], list_start[c + 1])
+
+public:
+    explicit IvfIndex(const IvfOptions& options = IvfOptions());
+
+    /// <summary>
+    /// Clusters and indexes count row-major vectors of dim floats, replacing any previous contents.
+    /// </summary>
+    void build(const float* data, size_t count, size_t dim, size_t threads = 0);
+
+    size_t size() const;
+    size_t get_dim() const;
+    size_t get_lists() const;
+    void set_probes(size_t probes);
+    const float* vector(uint32_t id) const;
+
+    void search_batch(const float* queries, size_t count, size_t k, std::vector<std::vector<Neighbor>>& results, size_t threads = 0) const;
+    std::vector<Neighbor> search(const float* query, size_t k) const;
+};
+
+/// <summary>
+/// Every pair of indexed vectors with cosine similarity of at least threshold, looking at each
+/// vector's k nearest neighbours (so a cluster larger than k + 1 is reported partially).
+/// Works with VectorIndex (exact) and IvfIndex (approximate).
+/// </summary>
+template<class Index>
+std::vector<DuplicatePair> find_near_duplicates(const Index& index, float threshold, size_t k = 10, size_t threads = 0);
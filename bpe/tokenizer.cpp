@@ -0,0 +1,166 @@
+#include "tokenizer.h"
+#include <queue>
+#include <functional>
+#include <stdexcept>
+
+namespace bpe {
+
+Tokenizer::Tokenizer() {}
+Tokenizer::~Tokenizer() {}
+
+void Tokenizer::build_ranks() {
+    ranks.clear();
+    // merged tokens are appended in the order they were learned, so the token ID is the merge rank
+    for (size_t i = 256; i < pairs.size(); ++i) {
+        if (!ranks.find(pairs[i])) ranks[pairs[i]] = static_cast<uint32_t>(i);
+    }
+}
+
+void Tokenizer::build_lookups() {
+    mapped.reset();
+    build_ranks();
+    decoder = DecodeTable(pairs);
+}
+
+void Tokenizer::train(const std::vector<std::string>& corpus, size_t max_vocab_size, const TrainOptions& options) {
+    pairs.clear();
+    learn_merges(corpus, pairs, max_vocab_size, options);
+    build_lookups();
+}
+
+void Tokenizer::train(const std::vector<std::string_view>& corpus, size_t max_vocab_size, const TrainOptions& options) {
+    pairs.clear();
+    learn_merges(corpus, pairs, max_vocab_size, options);
+    build_lookups();
+}
+
+void Tokenizer::set_pairs(const PairArray& vocab) {
+    pairs = vocab;
+    build_lookups();
+}
+
+void Tokenizer::set_vocab(std::shared_ptr<const MappedVocab> vocab) {
+    pairs = vocab->to_pair_array();
+    build_ranks();
+    decoder = DecodeTable(*vocab);
+    mapped = std::move(vocab);
+}
+
+/// <summary>
+/// Applies the learned merges in rank order. Every adjacent pair that is in the vocabulary
+/// sits in a min-heap keyed by (rank, position), so the earliest learned pair is always merged
+/// first and its occurrences go left to right, exactly like training did. Tokens form a linked
+/// list over their byte positions and heap entries whose pair no longer exists are skipped,
+/// which keeps encoding at O(n log n) per message.
+/// </summary>
+template<class Token>
+void Tokenizer::encode(std::string_view text, std::vector<Token>& tokens_out) const {
+    // a narrower Token would cut IDs of a larger vocabulary
+    if (sizeof(Token) < sizeof(uint32_t) && token_width_for(pairs.size()) != TokenWidth::Bits16) {
+        throw std::logic_error("Tokenizer::encode<uint16_t> with a vocabulary of more than 65536 tokens");
+    }
+    const uint32_t NONE = UINT32_MAX;
+    const uint32_t n = static_cast<uint32_t>(text.size());
+
+    struct Candidate {
+        uint32_t rank;
+        uint32_t pos;
+        bool operator>(const Candidate& other) const {
+            return rank > other.rank || (rank == other.rank && pos > other.pos);
+        }
+    };
+
+    Uint32Array tok(n);
+    std::vector<uint32_t> next(n), prev(n);
+    std::vector<Candidate> heap_storage;
+    heap_storage.reserve(n);
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> heap(std::greater<Candidate>(), std::move(heap_storage));
+
+    for (uint32_t i = 0; i < n; ++i) {
+        tok[i] = static_cast<uint8_t>(text[i]);
+        prev[i] = (i == 0) ? NONE : i - 1;
+        next[i] = (i + 1 == n) ? NONE : i + 1;
+    }
+
+    auto push_pair = [&](uint32_t pos) {
+        if (pos == NONE || next[pos] == NONE) return;
+        const uint32_t* rank = ranks.find(Pair{ tok[pos], tok[next[pos]] });
+        if (rank) heap.push({ *rank, pos });
+    };
+    for (uint32_t i = 0; i + 1 < n; ++i) push_pair(i);
+
+    while (!heap.empty()) {
+        Candidate c = heap.top();
+        heap.pop();
+        uint32_t j = next[c.pos];
+        // stale if the left token was absorbed or either side has been merged since
+        if (tok[c.pos] == NONE || j == NONE) continue;
+        const Pair& p = pairs[c.rank];
+        if (tok[c.pos] != p.l || tok[j] != p.r) continue;
+
+        tok[c.pos] = c.rank;
+        tok[j] = NONE;
+        next[c.pos] = next[j];
+        if (next[j] != NONE) prev[next[j]] = c.pos;
+
+        push_pair(prev[c.pos]);
+        push_pair(c.pos);
+    }
+
+    tokens_out.clear();
+    for (uint32_t i = (n == 0) ? NONE : 0; i != NONE; i = next[i]) {
+        tokens_out.push_back(static_cast<Token>(tok[i]));
+    }
+}
+
+template void Tokenizer::encode<uint16_t>(std::string_view, Uint16Array&) const;
+template void Tokenizer::encode<uint32_t>(std::string_view, Uint32Array&) const;
+
+Uint32Array Tokenizer::encode(std::string_view text) const {
+    Uint32Array tokens;
+    encode(text, tokens);
+    return tokens;
+}
+
+std::string Tokenizer::decode(const Uint32Array& tokens) const {
+    std::string out;
+    decoder.decode(tokens, out);
+    return out;
+}
+
+void Tokenizer::decode(const Uint32Array& tokens, std::string& out) const {
+    decoder.decode(tokens, out);
+}
+
+const DecodeTable& Tokenizer::get_decode_table() const {
+    return decoder;
+}
+
+void Tokenizer::save(const std::string& filename) const {
+    write_lookup_table(filename, pairs);
+}
+
+void Tokenizer::load(const std::string& filename) {
+    set_pairs(decompress_using_lookup_table(filename));
+}
+
+bool Tokenizer::save_binary(const std::string& filename) const {
+    return write_binary_vocab(filename, pairs);
+}
+
+bool Tokenizer::load_binary(const std::string& filename) {
+    auto vocab = std::make_shared<MappedVocab>();
+    if (!vocab->open(filename)) return false;
+    set_vocab(std::move(vocab));
+    return true;
+}
+
+const PairArray& Tokenizer::get_pairs() const {
+    return pairs;
+}
+
+size_t Tokenizer::get_vocab_size() const {
+    return pairs.size();
+}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <string>
+#include <string_view>
+#include "bpe.h"
+#include "binary_vocab.h"
+#include "decode_table.h"
+#include "pair_map.h"
+
+namespace bpe {
+
+/// <summary>
+/// Trains one BPE vocabulary over a whole corpus and then encodes any message
+/// against it, so token IDs mean the same thing in every message.
+/// </summary>
+class Tokenizer {
+    PairArray pairs;
+    PairMap<uint32_t> ranks; // merged pair -> token ID
+    DecodeTable decoder;     // owns its arena, or views the one in mapped
+    std::shared_ptr<const MappedVocab> mapped; // shared so copies keep the mapping open
+
+    void build_ranks();
+    void build_lookups();
+
+public:
+    Tokenizer();
+    ~Tokenizer();
+
+    /// <summary>
+    /// Learns merges over every message at once. max_vocab_size caps the number of
+    /// tokens including the 256 base tokens, 0 means merge until no pair repeats.
+    /// </summary>
+    void train(const std::vector<std::string>& corpus, size_t max_vocab_size = 0, const TrainOptions& options = TrainOptions());
+    void train(const std::vector<std::string_view>& corpus, size_t max_vocab_size = 0, const TrainOptions& options = TrainOptions());
+
+    /// <summary>
+    /// Uses an existing vocabulary, e.g. one loaded with decompress_using_lookup_table.
+    /// </summary>
+    void set_pairs(const PairArray& vocab);
+
+    /// <summary>
+    /// Uses an open binary vocabulary in place. Decoding reads its precomputed offsets and bytes
+    /// straight from the mapping; only the pair list and merge ranks for encoding are built.
+    /// </summary>
+    void set_vocab(std::shared_ptr<const MappedVocab> vocab);
+
+    Uint32Array encode(std::string_view text) const;
+    /// <summary>
+    /// Same as encode but reuses the caller's buffer. Safe to call from several threads.
+    /// Token is uint32_t, or uint16_t when token_width_for(get_vocab_size()) is Bits16; uint16_t
+    /// with a larger vocabulary throws std::logic_error.
+    /// </summary>
+    template<class Token>
+    void encode(std::string_view text, std::vector<Token>& tokens_out) const;
+    std::string decode(const Uint32Array& tokens) const;
+    void decode(const Uint32Array& tokens, std::string& out) const;
+    const DecodeTable& get_decode_table() const;
+
+    void save(const std::string& filename) const;
+    void load(const std::string& filename);
+    bool save_binary(const std::string& filename) const;
+    /// <summary>
+    /// Maps a binary vocabulary file and uses it with set_vocab.
+    /// </summary>
+    bool load_binary(const std::string& filename);
+
+    const PairArray& get_pairs() const;
+    size_t get_vocab_size() const;
+};
+
+}
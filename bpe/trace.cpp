@@ -0,0 +1,155 @@
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+struct Event {
+    const char* name;
+    const char* category;
+    char phase; // 'X' complete span, 'C' counter
+    int64_t ts_us;
+    int64_t dur_us;
+    uint32_t tid;
+    double value;
+};
+
+std::atomic<bool> tracing(false);
+std::mutex events_mutex;
+std::vector<Event> events;
+const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+int64_t micros_since_origin(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(t - origin).count();
+}
+
+// small stable IDs read better in the trace viewer than native thread handles
+uint32_t thread_index() {
+    static std::mutex ids_mutex;
+    static std::unordered_map<std::thread::id, uint32_t> ids;
+    thread_local uint32_t id = [] {
+        std::lock_guard<std::mutex> lock(ids_mutex);
+        uint32_t next = static_cast<uint32_t>(ids.size());
+        return ids.emplace(std::this_thread::get_id(), next).first->second;
+    }();
+    return id;
+}
+
+void record(const Event& e) {
+    std::lock_guard<std::mutex> lock(events_mutex);
+    events.push_back(e);
+}
+
+std::vector<Event> snapshot() {
+    std::lock_guard<std::mutex> lock(events_mutex);
+    return events;
+}
+
+void write_json_string(std::ostream& out, const char* s) {
+    out << '"';
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') out << '\\';
+        out << *s;
+    }
+    out << '"';
+}
+
+}
+
+void set_enabled(bool on) {
+    tracing.store(on, std::memory_order_relaxed);
+}
+
+bool enabled() {
+    return tracing.load(std::memory_order_relaxed);
+}
+
+void reset() {
+    std::lock_guard<std::mutex> lock(events_mutex);
+    events.clear();
+}
+
+void counter(const char* name, double value) {
+    if (!enabled()) return;
+    record({ name, "counter", 'C', micros_since_origin(std::chrono::steady_clock::now()), 0, thread_index(), value });
+}
+
+ScopedTimer::ScopedTimer(const char* name, const char* category)
+    : name(name), category(category), active(enabled()) {
+    if (active) start = std::chrono::steady_clock::now();
+}
+
+ScopedTimer::~ScopedTimer() {
+    if (!active) return;
+    auto end = std::chrono::steady_clock::now();
+    int64_t ts = micros_since_origin(start);
+    record({ name, category, 'X', ts, micros_since_origin(end) - ts, thread_index(), 0.0 });
+}
+
+bool write_chrome_trace(const std::string& filename) {
+    std::ofstream out(filename);
+    if (!out) {
+        std::cerr << "\nError writing trace file" << std::endl;
+        return false;
+    }
+    std::vector<Event> all = snapshot();
+    out << "{\"traceEvents\":[\n";
+    for (size_t i = 0; i < all.size(); ++i) {
+        const Event& e = all[i];
+        out << "{\"name\":";
+        write_json_string(out, e.name);
+        out << ",\"cat\":";
+        write_json_string(out, e.category);
+        out << ",\"ph\":\"" << e.phase << "\",\"ts\":" << e.ts_us << ",\"pid\":1,\"tid\":" << e.tid;
+        if (e.phase == 'X') out << ",\"dur\":" << e.dur_us;
+        else out << ",\"args\":{\"value\":" << e.value << "}";
+        out << "}" << (i + 1 < all.size() ? ",\n" : "\n");
+    }
+    out << "],\"displayTimeUnit\":\"ms\"}\n";
+    return static_cast<bool>(out);
+}
+
+bool write_metrics(const std::string& filename) {
+    std::ofstream out(filename);
+    if (!out) {
+        std::cerr << "\nError writing metrics file" << std::endl;
+        return false;
+    }
+    struct Timing {
+        size_t calls = 0;
+        int64_t total_us = 0;
+        int64_t max_us = 0;
+    };
+    std::map<std::string, Timing> timings;
+    std::map<std::string, double> counters;
+    for (const Event& e : snapshot()) {
+        if (e.phase == 'C') {
+            counters[e.name] = e.value;
+            continue;
+        }
+        Timing& t = timings[e.name];
+        t.calls++;
+        t.total_us += e.dur_us;
+        t.max_us = std::max(t.max_us, e.dur_us);
+    }
+    out << "# timer\tcalls\ttotal_ms\tmax_ms\n";
+    for (const auto& kv : timings) {
+        out << kv.first << "\t" << kv.second.calls << "\t" << kv.second.total_us / 1000.0 << "\t" << kv.second.max_us / 1000.0 << "\n";
+    }
+    out << "# counter\tvalue\n";
+    for (const auto& kv : counters) {
+        out << kv.first << "\t" << kv.second << "\n";
+    }
+    return static_cast<bool>(out);
+}
+
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Lightweight stage tracing. Nothing is recorded until set_enabled(true), so timers left in
+// hot code cost one atomic load when tracing is off. Recorded events can be exported as Chrome
+// trace JSON (load in chrome://tracing or Perfetto) or as a flat metrics file.
+namespace trace {
+
+void set_enabled(bool on);
+bool enabled();
+void reset();
+
+/// <summary>
+/// Records a counter sample, e.g. the number of merges learned or messages loaded.
+/// </summary>
+void counter(const char* name, double value);
+
+/// <summary>
+/// Times the enclosing scope. name and category must outlive the trace (string literals).
+/// </summary>
+class ScopedTimer {
+    const char* name;
+    const char* category;
+    std::chrono::steady_clock::time_point start;
+    bool active;
+
+public:
+    explicit ScopedTimer(const char* name, const char* category = "pipeline");
+    ~ScopedTimer();
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+bool write_chrome_trace(const std::string& filename);
+
+/// <summary>
+/// One line per timer (calls, total and max milliseconds) and per counter (last value).
+/// </summary>
+bool write_metrics(const std::string& filename);
+
+}